@@ -0,0 +1,812 @@
+// libcmvision - V4L2 YUYV capture and frame recordings
+//
+// v4l2 functions taken from python-v4l2capture module
+// (https://github.com/gebart/python-v4l2capture)
+
+#define _GNU_SOURCE
+#define USE_LIBV4L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef USE_LIBV4L
+#include <libv4l2.h>
+#else
+#define v4l2_close close
+#define v4l2_ioctl ioctl
+#define v4l2_mmap mmap
+#define v4l2_munmap munmap
+#define v4l2_open open
+#endif
+
+#include "cmvision.h"
+#include "cmv_capture.h"
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+static int xioctl(int fd, unsigned long request, void *arg) {
+	// Retry ioctl until it returns without being interrupted.
+	// Returns -1 and keeps errno on failure.
+	for(;;) {
+		int result = v4l2_ioctl(fd, request, arg);
+		if(!result) {
+			return 0;
+		}
+		if(errno != EINTR) {
+			return -1;
+		}
+	}
+}
+
+void cmv_capture_init(cmv_capture *cap) {
+	memset(cap, 0, sizeof(*cap));
+	cap->fd = -1;
+	cap->rec_fd = -1;
+	cap->memory = V4L2_MEMORY_MMAP;
+}
+
+static int set_resolution(cmv_capture *cap, int w, int h) {
+	struct v4l2_format format;
+	CLEAR(format);
+	format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	/* Get the current format */
+	if(xioctl(cap->fd, VIDIOC_G_FMT, &format)) {
+		return -1;
+	}
+
+	format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+	format.fmt.pix.field = V4L2_FIELD_INTERLACED;
+	format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	format.fmt.pix.width = w;
+	format.fmt.pix.height = h;
+	format.fmt.pix.bytesperline = 0;
+
+	if(xioctl(cap->fd, VIDIOC_S_FMT, &format)) {
+		return -1;
+	}
+
+	cap->width = w;
+	cap->height = h;
+	return 0;
+}
+
+static int set_fps(cmv_capture *cap, int fps) {
+	struct v4l2_streamparm setfps;
+	CLEAR(setfps);
+	setfps.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	setfps.parm.capture.timeperframe.numerator = 1;
+	setfps.parm.capture.timeperframe.denominator = fps;
+	return xioctl(cap->fd, VIDIOC_S_PARM, &setfps);
+}
+
+static int create_buffers(cmv_capture *cap, int buffer_count) {
+	struct v4l2_requestbuffers reqbuf;
+	CLEAR(reqbuf);
+	reqbuf.count = buffer_count;
+	reqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	reqbuf.memory = V4L2_MEMORY_MMAP;
+
+	if(xioctl(cap->fd, VIDIOC_REQBUFS, &reqbuf)) {
+		return -1;
+	}
+
+	if(!reqbuf.count) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	cap->buffers = calloc(reqbuf.count, sizeof(struct buffer));
+	if(!cap->buffers) {
+		return -1;
+	}
+	cap->memory = V4L2_MEMORY_MMAP;
+
+	int i;
+
+	for(i = 0; i < reqbuf.count; i++) {
+		struct v4l2_buffer buffer;
+		CLEAR(buffer);
+		buffer.index = i;
+		buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buffer.memory = V4L2_MEMORY_MMAP;
+
+		if(xioctl(cap->fd, VIDIOC_QUERYBUF, &buffer)) {
+			return -1;
+		}
+
+		cap->buffers[i].start = v4l2_mmap(NULL, buffer.length,
+			PROT_READ | PROT_WRITE, MAP_SHARED, cap->fd, buffer.m.offset);
+
+		if(cap->buffers[i].start == MAP_FAILED) {
+			cap->buffers[i].start = NULL;
+			return -1;
+		}
+		cap->buffers[i].length = buffer.length;
+		cap->buffer_count = i + 1;
+	}
+
+	return 0;
+}
+
+static int queue_all_buffers(cmv_capture *cap) {
+	int i;
+
+	for(i = 0; i < cap->buffer_count; i++) {
+		struct v4l2_buffer buffer;
+		CLEAR(buffer);
+		buffer.index = i;
+		buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buffer.memory = cap->memory;
+		if (cap->memory == V4L2_MEMORY_USERPTR) {
+			buffer.m.userptr = (unsigned long)cap->buffers[i].start;
+			buffer.length = cap->buffers[i].length;
+		} else if (cap->memory == V4L2_MEMORY_DMABUF) {
+			buffer.m.fd = cap->buffers[i].fd;
+			buffer.length = cap->buffers[i].length;
+		}
+
+		if(xioctl(cap->fd, VIDIOC_QBUF, &buffer)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void free_buffers(cmv_capture *cap) {
+	//unmap the capture buffers, caller buffers are left alone
+	int i;
+
+	for(i = 0; i < cap->buffer_count; i++) {
+		if (cap->buffers[i].start == NULL) {
+			continue;
+		}
+		if (cap->memory == V4L2_MEMORY_DMABUF) {
+			munmap(cap->buffers[i].start, cap->buffers[i].length);
+		} else if (cap->memory == V4L2_MEMORY_MMAP) {
+			if (cap->replay) {
+				free(cap->buffers[i].start);
+			} else {
+				v4l2_munmap(cap->buffers[i].start, cap->buffers[i].length);
+			}
+		}
+	}
+	free(cap->buffers);
+	cap->buffers = NULL;
+	cap->buffer_count = 0;
+	cap->next_buffer = 0;
+}
+
+static int pool_buffers(cmv_capture *cap, unsigned int memory, void *const *starts, const int *fds, size_t length, int count) {
+	//caller buffers as capture buffers, dmabufs are mapped
+	int i;
+
+	cap->buffers = calloc(count, sizeof(struct buffer));
+	if(!cap->buffers) {
+		return -1;
+	}
+	cap->memory = memory;
+
+	for(i = 0; i < count; i++) {
+		cap->buffers[i].length = length;
+		if (memory == V4L2_MEMORY_DMABUF) {
+			void *p = mmap(NULL, length, PROT_READ | (cap->replay ? PROT_WRITE : 0), MAP_SHARED, fds[i], 0);
+			if (p == MAP_FAILED) {
+				return -1;
+			}
+			cap->buffers[i].start = p;
+			cap->buffers[i].fd = fds[i];
+		} else {
+			cap->buffers[i].start = starts[i];
+		}
+		cap->buffer_count = i + 1;
+	}
+	return 0;
+}
+
+static int replay_buffer(cmv_capture *cap, size_t size) {
+	//single malloc buffer recorded frames are read into
+	cap->buffers = calloc(1, sizeof(struct buffer));
+	if (!cap->buffers) {
+		return -1;
+	}
+	cap->memory = V4L2_MEMORY_MMAP;
+	cap->buffers[0].start = malloc(size);
+	if (!cap->buffers[0].start) {
+		return -1;
+	}
+	cap->buffers[0].length = size;
+	cap->buffer_count = 1;
+	return 0;
+}
+
+static void request_none(cmv_capture *cap) {
+	//let the driver free its buffers of the current memory type
+	struct v4l2_requestbuffers reqbuf;
+	CLEAR(reqbuf);
+	reqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	reqbuf.memory = cap->memory;
+	xioctl(cap->fd, VIDIOC_REQBUFS, &reqbuf);
+}
+
+static ssize_t read_full(int fd, void *buf, size_t size) {
+	// Read until size bytes are read or end of file is reached.
+	size_t n = 0;
+	while (n < size) {
+		ssize_t r = read(fd, (char *)buf + n, size - n);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return r < 0 ? r : (ssize_t)n;
+		}
+		n += r;
+	}
+	return n;
+}
+
+static int open_replay(cmv_capture *cap, const char *path) {
+	frame_header header;
+	int fd = open(path, O_RDONLY);
+
+	if(fd < 0) {
+		return -1;
+	}
+	cap->fd = fd;
+	cap->replay = 1;
+
+	if (read_full(fd, &header, sizeof(header)) != sizeof(header)
+			|| header.magic != FRAME_MAGIC
+			|| header.format != V4L2_PIX_FMT_YUYV
+			|| header.width == 0 || header.width > MAX_WIDTH
+			|| header.height == 0 || header.height > MAX_HEIGHT) {
+		errno = EBADMSG;
+		return -1;
+	}
+	lseek(fd, 0, SEEK_SET);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	cap->width = header.width;
+	cap->height = header.height;
+
+	return replay_buffer(cap, header.size > (size_t)header.width * header.height * 2 ? header.size : (size_t)header.width * header.height * 2);
+}
+
+int cmv_capture_open(cmv_capture *cap, const char *path, int w, int h, int fps, int buffer_count) {
+	//open device or recording, close it again on failure
+	struct stat st;
+	int result;
+
+	if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+		//replay recorded frames
+		result = open_replay(cap, path);
+	} else {
+		cap->fd = v4l2_open(path, O_RDWR | O_NONBLOCK);
+		result = cap->fd < 0
+			|| set_resolution(cap, w, h)
+			|| create_buffers(cap, buffer_count)
+			|| queue_all_buffers(cap) ? -1 : 0;
+		if (!result) {
+			// not every driver can set the frame rate
+			set_fps(cap, fps);
+		}
+	}
+
+	if (result) {
+		int err = errno;
+		cmv_capture_close(cap);
+		errno = err;
+	}
+	return result;
+}
+
+int cmv_capture_frame_size(cmv_capture *cap, size_t *size) {
+	//bytes the driver writes per frame
+	struct v4l2_format format;
+	if (cap->replay) {
+		*size = (size_t)cap->width * cap->height * 2;
+		return 0;
+	}
+	CLEAR(format);
+	format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if(xioctl(cap->fd, VIDIOC_G_FMT, &format)) {
+		return -1;
+	}
+	*size = format.fmt.pix.sizeimage;
+	return 0;
+}
+
+int cmv_capture_set_pool(cmv_capture *cap, unsigned int memory, void *const *starts, const int *fds, size_t length, int count) {
+// Streaming is stopped while the buffers are swapped and started again
+// afterwards, frames in the old buffers are dropped. Once the arguments
+// are checked the old buffers are always given up: cap->memory tells
+// which buffers are used afterwards, cap->buffers is NULL if none.
+	struct v4l2_requestbuffers reqbuf;
+	size_t size;
+	int started = cap->started;
+	int restore = cap->replay ? 1 : cap->buffer_count;
+	int result, err;
+
+	if (cap->fd < 0) {
+		errno = EBADF;
+		return -1;
+	}
+	if (cmv_capture_frame_size(cap, &size)) {
+		return -1;
+	}
+	if (memory != V4L2_MEMORY_MMAP && (count <= 0 || length < size)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (cap->replay) {
+		//recorded frames are read into the pool in turn
+		free_buffers(cap);
+		if (memory == V4L2_MEMORY_MMAP) {
+			result = replay_buffer(cap, size);
+		} else {
+			result = pool_buffers(cap, memory, starts, fds, length, count);
+		}
+		if (result) {
+			err = errno;
+			free_buffers(cap);
+			if (replay_buffer(cap, size)) {
+				free_buffers(cap);
+			}
+			errno = err;
+		}
+		return result;
+	}
+
+	if (started) {
+		cmv_capture_stop(cap);
+	}
+	cap->started = 0;
+	free_buffers(cap);
+	request_none(cap);
+
+	if (memory == V4L2_MEMORY_MMAP) {
+		result = create_buffers(cap, count > 0 ? count : restore) || queue_all_buffers(cap) ? -1 : 0;
+	} else {
+		CLEAR(reqbuf);
+		reqbuf.count = count;
+		reqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		reqbuf.memory = memory;
+		result = xioctl(cap->fd, VIDIOC_REQBUFS, &reqbuf);
+		if (!result && (reqbuf.count == 0 || reqbuf.count > (unsigned int)count)) {
+			//driver needs more buffers than the pool has
+			errno = ENOBUFS;
+			result = -1;
+		}
+		if (!result) {
+			result = pool_buffers(cap, memory, starts, fds, length, reqbuf.count) || queue_all_buffers(cap) ? -1 : 0;
+		}
+		if (result) {
+			//fall back to driver buffers
+			err = errno;
+			free_buffers(cap);
+			cap->memory = memory;
+			request_none(cap);
+			if (create_buffers(cap, restore) || queue_all_buffers(cap)) {
+				err = errno;
+				free_buffers(cap);
+			}
+			errno = err;
+		}
+	}
+	if (result && memory == V4L2_MEMORY_MMAP) {
+		//no usable buffers
+		err = errno;
+		free_buffers(cap);
+		errno = err;
+	}
+
+	if (started && cmv_capture_start(cap)) {
+		return -1;
+	}
+	return result;
+}
+
+void cmv_capture_close(cmv_capture *cap) {
+	cmv_record_stop(cap);
+	free(cap->rec_path);
+	cap->rec_path = NULL;
+
+	free_buffers(cap);
+	cap->memory = V4L2_MEMORY_MMAP;
+
+	if(cap->fd >= 0) {
+		if (cap->replay) {
+			close(cap->fd);
+		} else {
+			v4l2_close(cap->fd);
+		}
+	}
+	cap->fd = -1;
+	cap->started = 0;
+}
+
+int cmv_capture_start(cmv_capture *cap) {
+	enum v4l2_buf_type type;
+	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+	if(!cap->replay && xioctl(cap->fd, VIDIOC_STREAMON, &type)) {
+		return -1;
+	}
+	cap->started = 1;
+	return 0;
+}
+
+int cmv_capture_stop(cmv_capture *cap) {
+	enum v4l2_buf_type type;
+	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+	if(!cap->replay && xioctl(cap->fd, VIDIOC_STREAMOFF, &type)) {
+		return -1;
+	}
+	return 0;
+}
+
+static int record_open(cmv_capture *cap) {
+	char path[4096];
+	if (cap->rec_frames > 0) {
+		snprintf(path, sizeof(path), "%s.%03d", cap->rec_path, cap->rec_file_i);
+	} else {
+		snprintf(path, sizeof(path), "%s", cap->rec_path);
+	}
+
+	cap->rec_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	cap->rec_frame_i = 0;
+	cap->rec_offset = 0;
+	return cap->rec_fd < 0 ? -1 : 0;
+}
+
+int cmv_record_start(cmv_capture *cap, const char *path, int frames, int files) {
+	char *rec_path = strdup(path);
+	if (rec_path == NULL) {
+		return -1;
+	}
+	cmv_record_stop(cap);
+	free(cap->rec_path);
+	cap->rec_path = rec_path;
+	cap->rec_frames = frames;
+	cap->rec_files = files;
+	cap->rec_file_i = 0;
+	cap->rec_error = 0;
+	return record_open(cap);
+}
+
+void cmv_record_stop(cmv_capture *cap) {
+	if (cap->rec_fd >= 0) {
+		close(cap->rec_fd);
+		cap->rec_fd = -1;
+	}
+}
+
+int cmv_record_error(cmv_capture *cap) {
+	if (cap->rec_error) {
+		errno = cap->rec_error;
+		cap->rec_error = 0;
+		return -1;
+	}
+	return 0;
+}
+
+static void record_frame(cmv_capture *cap, struct v4l2_buffer *buffer) {
+// Appends the dequeued buffer to the recording with a single writev,
+// the frame data is written straight from the mmap buffer.
+	if (cap->rec_frames > 0 && cap->rec_frame_i == cap->rec_frames) {
+		// file is full, continue in the next one of the ring
+		cmv_record_stop(cap);
+		cap->rec_file_i++;
+		if (cap->rec_files > 0 && cap->rec_file_i >= cap->rec_files) {
+			cap->rec_file_i = 0;
+		}
+		if (record_open(cap)) {
+			cap->rec_error = errno;
+			return;
+		}
+	}
+
+	frame_header header;
+	header.magic = FRAME_MAGIC;
+	header.sequence = buffer->sequence;
+	header.timestamp = cap->frame_time;
+	header.format = V4L2_PIX_FMT_YUYV;
+	header.width = cap->width;
+	header.height = cap->height;
+	header.size = buffer->bytesused ? buffer->bytesused : cap->buffers[buffer->index].length;
+	header.reserved = 0;
+
+	struct iovec iov[2];
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = cap->buffers[buffer->index].start;
+	iov[1].iov_len = header.size;
+
+	ssize_t n = writev(cap->rec_fd, iov, 2);
+	if (n != (ssize_t)(sizeof(header) + header.size)) {
+		cap->rec_error = n < 0 ? errno : ENOSPC;
+		cmv_record_stop(cap);
+		return;
+	}
+#ifdef SYNC_FILE_RANGE_WRITE
+	// start writeback right away, so dirty pages never pile up into a long stall
+	sync_file_range(cap->rec_fd, cap->rec_offset, n, SYNC_FILE_RANGE_WRITE);
+#endif
+	cap->rec_offset += n;
+	cap->rec_frame_i++;
+}
+
+static int replay_frame(cmv_capture *cap, struct v4l2_buffer *buffer) {
+// Reads the next recorded frame into the replay buffer. Returns -1 and
+// sets errno to ENODATA at the end of the recording.
+	frame_header header;
+
+	ssize_t n = read_full(cap->fd, &header, sizeof(header));
+	if (n == 0) {
+		errno = ENODATA;
+		return -1;
+	}
+	if (n != sizeof(header) || header.magic != FRAME_MAGIC || header.width != cap->width || header.height != cap->height) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	int i = cap->next_buffer;
+	size_t size = header.size < cap->buffers[i].length ? header.size : cap->buffers[i].length;
+	if (read_full(cap->fd, cap->buffers[i].start, size) != (ssize_t)size
+			|| (header.size > size && lseek(cap->fd, header.size - size, SEEK_CUR) < 0)) {
+		errno = ENODATA;
+		return -1;
+	}
+
+	cap->next_buffer = (i + 1) % cap->buffer_count;
+	buffer->index = i;
+	buffer->bytesused = size;
+	buffer->sequence = header.sequence;
+	buffer->timestamp.tv_sec = header.timestamp / 1000000;
+	buffer->timestamp.tv_usec = header.timestamp % 1000000;
+	return 0;
+}
+
+int cmv_capture_dequeue(cmv_capture *cap, struct v4l2_buffer *buffer) {
+// Takes the next filled buffer from the driver (or the recording)
+// without waiting for it.
+	CLEAR(*buffer);
+	buffer->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buffer->memory = cap->memory;
+	if(!cap->buffers) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (cap->replay) {
+		if (replay_frame(cap, buffer)) {
+			return -1;
+		}
+	} else if (xioctl(cap->fd, VIDIOC_DQBUF, buffer)) {
+		return -1;
+	}
+
+	cap->frame_seq = buffer->sequence;
+	cap->frame_time = (unsigned long long)buffer->timestamp.tv_sec * 1000000 + buffer->timestamp.tv_usec;
+	if (cap->rec_fd >= 0) {
+		record_frame(cap, buffer);
+	}
+	return 0;
+}
+
+int cmv_capture_release(cmv_capture *cap, struct v4l2_buffer *buffer) {
+	//give the buffer back to the driver
+	if (cap->replay) {
+		return 0;
+	}
+	return xioctl(cap->fd, VIDIOC_QBUF, buffer);
+}
+
+int cmv_capture_wait(cmv_capture *cap, int timeout_ms) {
+	//wait until a frame can be dequeued
+	if (cap->replay) {
+		return 1;
+	}
+	fd_set fds;
+	struct timeval tv;
+
+	FD_ZERO(&fds);
+	FD_SET(cap->fd, &fds);
+
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+	int r = select(cap->fd + 1, &fds, NULL, NULL, &tv);
+	return r > 0 ? 1 : r;
+}
+
+int cmv_capture_get_ctrl(cmv_capture *cap, int id, int *value) {
+	struct v4l2_control ctrl;
+	CLEAR(ctrl);
+	ctrl.id = id;
+	if (xioctl(cap->fd, VIDIOC_G_CTRL, &ctrl)) {
+		return -1;
+	}
+	*value = ctrl.value;
+	return 0;
+}
+
+int cmv_capture_set_ctrl(cmv_capture *cap, int id, int value) {
+	struct v4l2_control ctrl;
+	CLEAR(ctrl);
+	ctrl.id = id;
+	ctrl.value = value;
+	return xioctl(cap->fd, VIDIOC_S_CTRL, &ctrl);
+}
+
+static int ext_ctrls(cmv_capture *cap, unsigned long request, const int *ids, int *values, int n, int *failed) {
+	// one VIDIOC_S_EXT_CTRLS or VIDIOC_G_EXT_CTRLS for n controls of any class
+	struct v4l2_ext_controls ctrls;
+	struct v4l2_ext_control *c = (struct v4l2_ext_control *)calloc(n, sizeof(struct v4l2_ext_control));
+	int i, result, err;
+
+	if (c == NULL) {
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		c[i].id = ids[i];
+		c[i].value = values[i];
+	}
+	CLEAR(ctrls);
+	ctrls.count = n;
+	ctrls.error_idx = n;
+	ctrls.controls = c;
+	result = xioctl(cap->fd, request, &ctrls);
+	err = errno;
+	if (result) {
+		*failed = ctrls.error_idx;
+	} else if (request == VIDIOC_G_EXT_CTRLS) {
+		for (i = 0; i < n; i++) {
+			values[i] = c[i].value;
+		}
+	}
+	free(c);
+	errno = err;
+	return result;
+}
+
+static int ext_unsupported(int failed, int n) {
+	// the driver has no extended controls, or rejected the request as a whole
+	return errno == ENOTTY || (errno == EINVAL && failed >= n);
+}
+
+int cmv_capture_set_ctrls(cmv_capture *cap, const int *ids, const int *values, int n, int *failed) {
+// Sets n controls with one VIDIOC_S_EXT_CTRLS. Drivers without extended
+// controls get one VIDIOC_S_CTRL per control instead.
+	int i, f = n;
+
+	if (n <= 0 || ext_ctrls(cap, VIDIOC_S_EXT_CTRLS, ids, (int *)values, n, &f) == 0) {
+		return 0;
+	}
+	if (!ext_unsupported(f, n)) {
+		if (failed) *failed = f;
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (cmv_capture_set_ctrl(cap, ids[i], values[i])) {
+			if (failed) *failed = i;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int cmv_capture_get_ctrls(cmv_capture *cap, const int *ids, int *values, int n, int *failed) {
+// Reads n controls with one VIDIOC_G_EXT_CTRLS, or one VIDIOC_G_CTRL
+// per control if the driver has no extended controls.
+	int i, f = n;
+
+	if (n <= 0) {
+		return 0;
+	}
+	memset(values, 0, n * sizeof(int));
+	if (ext_ctrls(cap, VIDIOC_G_EXT_CTRLS, ids, values, n, &f) == 0) {
+		return 0;
+	}
+	if (!ext_unsupported(f, n)) {
+		if (failed) *failed = f;
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (cmv_capture_get_ctrl(cap, ids[i], &values[i])) {
+			if (failed) *failed = i;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+unsigned int cmv_capture_settled_seq(cmv_capture *cap) {
+	// frames up to the last dequeued one plus all buffers in the driver may
+	// already be exposed, the one after them is captured with new controls
+	return cap->frame_seq + (cap->replay ? 0 : cap->buffer_count) + 1;
+}
+
+int cmv_recording_map(cmv_recording *rec, const char *path) {
+// Maps a recording read only and indexes its frames without copying
+// them. An incomplete last frame (recording still being written or cut
+// off) is left out.
+	struct stat st;
+	size_t offset = 0;
+	int cap = 0;
+	int fd = open(path, O_RDONLY);
+
+	memset(rec, 0, sizeof(*rec));
+	if (fd < 0) {
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	rec->length = st.st_size;
+	rec->data = rec->length ? (unsigned char *)mmap(NULL, rec->length, PROT_READ, MAP_SHARED, fd, 0) : NULL;
+	close(fd);
+	if (rec->data == MAP_FAILED) {
+		rec->data = NULL;
+		return -1;
+	}
+	madvise(rec->data, rec->length, MADV_SEQUENTIAL);
+
+	while (offset + sizeof(frame_header) <= rec->length) {
+		frame_header header;
+		memcpy(&header, rec->data + offset, sizeof(header));
+		if (header.magic != FRAME_MAGIC || header.format != V4L2_PIX_FMT_YUYV
+				|| header.width == 0 || header.width > MAX_WIDTH
+				|| header.height == 0 || header.height > MAX_HEIGHT
+				|| (rec->count > 0 && (header.width != rec->width || header.height != rec->height))
+				|| header.size < (size_t)header.width * header.height * 2) {
+			cmv_recording_unmap(rec);
+			errno = EBADMSG;
+			return -1;
+		}
+		offset += sizeof(header);
+		if (offset + header.size > rec->length) {
+			break;
+		}
+		if (rec->count == cap) {
+			const unsigned char **frames;
+			cap = cap ? cap * 2 : 256;
+			frames = (const unsigned char **)realloc(rec->frames, cap * sizeof(*frames));
+			if (frames == NULL) {
+				cmv_recording_unmap(rec);
+				errno = ENOMEM;
+				return -1;
+			}
+			rec->frames = frames;
+		}
+		rec->frames[rec->count++] = rec->data + offset;
+		rec->width = header.width;
+		rec->height = header.height;
+		offset += header.size;
+	}
+	if (rec->count == 0) {
+		cmv_recording_unmap(rec);
+		errno = EBADMSG;
+		return -1;
+	}
+	return 0;
+}
+
+void cmv_recording_unmap(cmv_recording *rec) {
+	if (rec->data != NULL) {
+		munmap(rec->data, rec->length);
+	}
+	free(rec->frames);
+	memset(rec, 0, sizeof(*rec));
+}
@@ -0,0 +1,123 @@
+// libcmvision - V4L2 YUYV capture and frame recordings
+//
+// Functions return 0 on success and -1 with errno set on failure, they
+// never block except cmv_capture_wait.
+
+#ifndef CMV_CAPTURE_H
+#define CMV_CAPTURE_H
+
+#include <sys/types.h>
+#include <linux/videodev2.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_MAGIC 0x52564d43 //"CMVR"
+
+typedef struct {
+	unsigned int magic;
+	unsigned int sequence;//V4L2 frame sequence number
+	unsigned long long timestamp;//capture time in microseconds
+	unsigned int format;//V4L2 pixel format
+	unsigned short width, height;
+	unsigned int size;//frame bytes following the header
+	unsigned int reserved;
+} frame_header;
+
+struct buffer {
+	void *start;
+	size_t length;
+	int fd;//dmabuf of V4L2_MEMORY_DMABUF buffers
+};
+
+typedef struct {
+	int fd;
+	struct buffer *buffers;
+	int buffer_count;
+	unsigned int memory;//V4L2_MEMORY_MMAP, or USERPTR/DMABUF for caller buffers
+	int next_buffer;//replay buffer the next frame is read into
+	int width, height;
+	unsigned char started;
+	unsigned char replay;//frames are read from a recording instead of the device
+
+	unsigned int frame_seq;//sequence number of the last frame
+	unsigned long long frame_time;//timestamp of the last frame in microseconds
+
+	int rec_fd;//recording file, -1 if not recording
+	char *rec_path;
+	int rec_frames, rec_files;//frames per file and files in the ring, 0=unlimited
+	int rec_frame_i, rec_file_i;
+	off_t rec_offset;
+	int rec_error;//errno that stopped the recording, 0=none
+} cmv_capture;
+
+void cmv_capture_init(cmv_capture *cap);
+
+// opens a V4L2 device, or a recording when path is a regular file
+// (errno EBADMSG if it is not a YUYV recording)
+int cmv_capture_open(cmv_capture *cap, const char *path, int w, int h, int fps, int buffer_count);
+void cmv_capture_close(cmv_capture *cap);
+
+int cmv_capture_start(cmv_capture *cap);
+int cmv_capture_stop(cmv_capture *cap);
+
+// 1=frame ready, 0=timeout, -1=error
+int cmv_capture_wait(cmv_capture *cap, int timeout_ms);
+
+// takes the next frame without waiting (errno EAGAIN if none is ready,
+// ENODATA at the end of a recording, EBADMSG if the recording is corrupt),
+// its data is cap->buffers[buffer->index].start until it is released
+int cmv_capture_dequeue(cmv_capture *cap, struct v4l2_buffer *buffer);
+int cmv_capture_release(cmv_capture *cap, struct v4l2_buffer *buffer);
+
+// bytes per frame a capture buffer must hold
+int cmv_capture_frame_size(cmv_capture *cap, size_t *size);
+
+// replaces the capture buffers by count caller buffers of length bytes:
+// memory V4L2_MEMORY_USERPTR uses starts, V4L2_MEMORY_DMABUF imports the
+// dmabuf fds (mapped here, they must stay open) and V4L2_MEMORY_MMAP
+// returns to driver buffers. If the driver refuses, the capture falls back
+// to driver buffers (cap->memory) and -1 is returned with errno of the
+// refusal, cap->buffers is NULL if no buffers could be set up at all.
+int cmv_capture_set_pool(cmv_capture *cap, unsigned int memory, void *const *starts, const int *fds, size_t length, int count);
+
+int cmv_capture_get_ctrl(cmv_capture *cap, int id, int *value);
+int cmv_capture_set_ctrl(cmv_capture *cap, int id, int value);
+
+// n controls in one ioctl where the driver supports extended controls,
+// on failure *failed is the index of the rejected control or n if unknown
+int cmv_capture_get_ctrls(cmv_capture *cap, const int *ids, int *values, int n, int *failed);
+int cmv_capture_set_ctrls(cmv_capture *cap, const int *ids, const int *values, int n, int *failed);
+
+// first frame sequence number captured after controls set now, frames
+// already queued in the driver may still use the old values
+unsigned int cmv_capture_settled_seq(cmv_capture *cap);
+
+// appends every dequeued frame to path, or to a ring of files
+// path.000, path.001, ... of frames each when frames > 0
+int cmv_record_start(cmv_capture *cap, const char *path, int frames, int files);
+void cmv_record_stop(cmv_capture *cap);
+
+// -1 with errno set once if writing a frame failed and stopped the
+// recording (ENOSPC for a short write), 0 otherwise
+int cmv_record_error(cmv_capture *cap);
+
+typedef struct {
+	unsigned char *data;//mapped recording file
+	size_t length;
+	const unsigned char **frames;//YUYV data of each complete frame
+	int count;
+	int width, height;
+} cmv_recording;
+
+// maps a recording of cmv_record_start read only for random access to
+// its frames (errno EBADMSG if it is not a YUYV recording or empty)
+int cmv_recording_map(cmv_recording *rec, const char *path);
+void cmv_recording_unmap(cmv_recording *rec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,199 @@
+// libcmvision - hardware performance counters per pipeline stage
+//
+// All counters form one perf event group, so a single read() per stage
+// returns all of them and they are always scheduled together.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "cmv_perf.h"
+
+const char *const cmv_stage_names[CMV_STAGE_COUNT] = {
+	"threshold", "encode", "morph", "connect", "close", "extract", "separate", "sort"
+};
+
+const char *const cmv_perf_names[CMV_PERF_COUNT] = {
+	"cycles", "instructions", "llc_misses", "dtlb_misses", "branch_misses"
+};
+
+#define CACHE_READ_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+	unsigned int type;
+	unsigned long long config;
+} perf_events[CMV_PERF_COUNT] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL)},
+	{PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+static double now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int perf_event(int i, int group) {
+	//user space counter of the calling thread, -1 if not allowed or supported
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = perf_events[i].type;
+	attr.config = perf_events[i].config;
+	attr.disabled = group < 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static int read_group(cmv_perf *p, unsigned long long *values) {
+	//time enabled, time running and the counters in slot order
+	unsigned long long buf[CMV_PERF_COUNT + 3];
+	size_t size = (p->n + 3) * sizeof(buf[0]);
+
+	if (p->group < 0 || read(p->group, buf, size) != (ssize_t)size) {
+		return -1;
+	}
+	memcpy(values, buf + 1, (p->n + 2) * sizeof(buf[0]));
+	return 0;
+}
+
+void cmv_perf_init(cmv_perf *p) {
+	int i;
+	for (i = 0; i < CMV_PERF_COUNT; i++) {
+		p->fds[i] = -1;
+		p->slot[i] = -1;
+	}
+	p->n = 0;
+	p->group = -1;
+	p->tid = 0;
+	cmv_perf_reset(p);
+}
+
+int cmv_perf_open(cmv_perf *p) {
+// Counters which cannot be opened (no PMU in a VM, perf_event_paranoid
+// in a container, unknown cache event) are left out, the rest still count.
+	int i;
+
+	cmv_perf_close(p);
+	p->tid = syscall(SYS_gettid);
+	for (i = 0; i < CMV_PERF_COUNT; i++) {
+		int fd = perf_event(i, p->group);
+		if (fd < 0) {
+			continue;
+		}
+		if (p->group < 0) {
+			p->group = fd;
+		}
+		p->fds[i] = fd;
+		p->slot[i] = p->n++;
+		p->available |= 1 << i;
+	}
+	if (p->group >= 0) {
+		ioctl(p->group, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+	return p->n;
+}
+
+void cmv_perf_close(cmv_perf *p) {
+	int i;
+	for (i = 0; i < CMV_PERF_COUNT; i++) {
+		if (p->fds[i] >= 0) {
+			close(p->fds[i]);
+		}
+		p->fds[i] = -1;
+		p->slot[i] = -1;
+	}
+	p->n = 0;
+	p->group = -1;
+	p->tid = 0;
+}
+
+void cmv_perf_reset(cmv_perf *p) {
+	int i;
+	memset(p->stages, 0, sizeof(p->stages));
+	p->available = 0;
+	for (i = 0; i < CMV_PERF_COUNT; i++) {
+		if (p->fds[i] >= 0) {
+			p->available |= 1 << i;
+		}
+	}
+}
+
+void cmv_perf_begin(cmv_perf *p) {
+	if (p->tid != syscall(SYS_gettid)) {
+		// counters only count the thread they were opened in
+		cmv_perf_open(p);
+	}
+	cmv_perf_skip(p);
+}
+
+void cmv_perf_skip(cmv_perf *p) {
+	read_group(p, p->last);
+	p->last_us = now_us();
+}
+
+void cmv_perf_stage(cmv_perf *p, int stage) {
+// Adds time and counter deltas since the last snapshot to stage. The time
+// of the read itself is left out of the next stage.
+	unsigned long long now[CMV_PERF_COUNT + 2];
+	cmv_stage_stats *s = &p->stages[stage];
+	double us = now_us() - p->last_us;
+	int i;
+
+	if (s->calls == 0 || us < s->min_us) {
+		s->min_us = us;
+	}
+	if (us > s->max_us) {
+		s->max_us = us;
+	}
+	s->total_us += us;
+	s->calls++;
+
+	if (read_group(p, now) == 0) {
+		unsigned long long enabled = now[0] - p->last[0];
+		unsigned long long running = now[1] - p->last[1];
+		for (i = 0; running > 0 && i < CMV_PERF_COUNT; i++) {
+			if (p->slot[i] >= 0) {
+				unsigned long long d = now[2 + p->slot[i]] - p->last[2 + p->slot[i]];
+				// scale up when the group shared the PMU with other events
+				s->counts[i] += running < enabled ? (unsigned long long)((double)d * enabled / running) : d;
+			}
+		}
+		memcpy(p->last, now, sizeof(now));
+	}
+	p->last_us = now_us();
+}
+
+int cmv_perf_write_csv(const cmv_perf *p, FILE *f) {
+	int i, j;
+
+	fprintf(f, "stage,calls,total_us,min_us,max_us");
+	for (j = 0; j < CMV_PERF_COUNT; j++) {
+		fprintf(f, ",%s", cmv_perf_names[j]);
+	}
+	fprintf(f, "\n");
+	for (i = 0; i < CMV_STAGE_COUNT; i++) {
+		const cmv_stage_stats *s = &p->stages[i];
+		fprintf(f, "%s,%llu,%.1f,%.1f,%.1f", cmv_stage_names[i], s->calls, s->total_us, s->min_us, s->max_us);
+		for (j = 0; j < CMV_PERF_COUNT; j++) {
+			if (p->available & (1 << j)) {
+				fprintf(f, ",%llu", s->counts[j]);
+			} else {
+				fprintf(f, ",");
+			}
+		}
+		fprintf(f, "\n");
+	}
+	return ferror(f) ? -1 : 0;
+}
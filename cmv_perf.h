@@ -0,0 +1,84 @@
+// libcmvision - hardware performance counters per pipeline stage
+//
+// Counts cycles, instructions, last level cache misses, dTLB misses and
+// branch misses of every stage of cmv_segment with perf_event_open, next
+// to wall clock time. Counters the kernel or container does not allow are
+// left out, times are always recorded.
+
+#ifndef CMV_PERF_H
+#define CMV_PERF_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+	CMV_STAGE_THRESHOLD,
+	CMV_STAGE_ENCODE,
+	CMV_STAGE_MORPH,
+	CMV_STAGE_CONNECT,
+	CMV_STAGE_CLOSE,
+	CMV_STAGE_EXTRACT,
+	CMV_STAGE_SEPARATE,
+	CMV_STAGE_SORT,
+	CMV_STAGE_COUNT
+};
+
+enum {
+	CMV_PERF_CYCLES,
+	CMV_PERF_INSTRUCTIONS,
+	CMV_PERF_LLC_MISSES,
+	CMV_PERF_DTLB_MISSES,
+	CMV_PERF_BRANCH_MISSES,
+	CMV_PERF_COUNT
+};
+
+extern const char *const cmv_stage_names[CMV_STAGE_COUNT];
+extern const char *const cmv_perf_names[CMV_PERF_COUNT];
+
+typedef struct {
+	unsigned long long calls;
+	double total_us, min_us, max_us;
+	unsigned long long counts[CMV_PERF_COUNT];//summed over all calls
+} cmv_stage_stats;
+
+typedef struct cmv_perf {
+	int fds[CMV_PERF_COUNT];//-1 if the counter is not available
+	int slot[CMV_PERF_COUNT];//position of the counter in a group read
+	int n;//counters in the group
+	int group;//fd of the group leader, -1 if there are no counters
+	long tid;//thread the counters count, 0=none
+	unsigned int available;//1 << CMV_PERF_* of counters in the statistics
+	double last_us;
+	unsigned long long last[CMV_PERF_COUNT + 2];//time enabled, time running and counters at the last snapshot
+	cmv_stage_stats stages[CMV_STAGE_COUNT];
+} cmv_perf;
+
+// no counters and empty statistics
+void cmv_perf_init(cmv_perf *p);
+
+// attaches the counters to the calling thread, returns how many are
+// available. cmv_perf_begin reopens them when another thread segments,
+// so segment on one long lived thread, not a new one per frame.
+int cmv_perf_open(cmv_perf *p);
+void cmv_perf_close(cmv_perf *p);
+void cmv_perf_reset(cmv_perf *p);
+
+// snapshot at the start of a frame, then after each stage
+void cmv_perf_begin(cmv_perf *p);
+void cmv_perf_stage(cmv_perf *p, int stage);
+
+// snapshot without adding to a stage, leaves out work between stages
+void cmv_perf_skip(cmv_perf *p);
+
+// stage,calls,total_us,min_us,max_us and the counter totals, empty for
+// counters that are not available
+int cmv_perf_write_csv(const cmv_perf *p, FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,276 @@
+// cmvision-bench - per stage timings of the libcmvision pipeline
+//
+// Runs the segmentation engine on frames of a recording written by
+// Camera.record(), a V4L2 device or synthetic frames, and prints how
+// long each stage took and, where perf_event_open is allowed, what it
+// cost in cycles, instructions, cache, dTLB and branch misses.
+//
+// Usage: cmvision-bench [-n frames] [-s WxH] [-l lut] [-m] [-i tile] [-c csv] [path]
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cmvision.h"
+#include "cmv_capture.h"
+#include "cmv_perf.h"
+
+static int load_lut(cmv_config *cfg, const char *path) {
+	//raw 256*256*256 color ids indexed [v][u][y], as written by numpy tofile()
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		return -1;
+	}
+	size_t n = fread(cfg->colors_lookup, 1, sizeof(cfg->colors_lookup), f);
+	fclose(f);
+	if (n != sizeof(cfg->colors_lookup)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+static void default_lut(cmv_config *cfg) {
+	//1=high V (orange), 2=high U (blue), everything else 0
+	int y, u, v;
+	for (v = 0; v < 256; v++) {
+		for (u = 0; u < 256; u++) {
+			unsigned char c = 0;
+			if (v > 170 && u < 128) c = 1;
+			else if (u > 170 && v < 128) c = 2;
+			for (y = 0; y < 256; y++) {
+				cfg->colors_lookup[y + (u << 8) + (v << 16)] = y > 30 ? c : 0;
+			}
+		}
+	}
+}
+
+static void synthetic_frame(unsigned char *f, int w, int h, int i) {
+// Gray YUYV frame with two moving discs of color 1 and 2 and some
+// sensor-like noise, deterministic for a given frame number.
+	int x, y;
+	int cx1 = (w / 4 + i * 3) % w, cy1 = h / 2;
+	int cx2 = w - 1 - (w / 4 + i * 2) % w, cy2 = h / 3;
+	int r1 = h / 10, r2 = h / 16;
+	unsigned int seed = 12345 + i;
+
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x += 2) {
+			unsigned char *p = f + (y * w + x) * 2;
+			int u = 128, v = 128;
+			int dx1 = x - cx1, dy1 = y - cy1;
+			int dx2 = x - cx2, dy2 = y - cy2;
+			if (dx1 * dx1 + dy1 * dy1 < r1 * r1) {
+				u = 80; v = 200;
+			} else if (dx2 * dx2 + dy2 * dy2 < r2 * r2) {
+				u = 200; v = 90;
+			}
+			seed = seed * 1103515245 + 12345;
+			if ((seed >> 16) % 500 == 0) {
+				u = 80; v = 200;//isolated noise pixel
+			}
+			p[0] = 120;
+			p[1] = u;
+			p[2] = 120;
+			p[3] = v;
+		}
+	}
+}
+
+static void usage(const char *name) {
+	fprintf(stderr,
+		"Usage: %s [-n frames] [-s WxH] [-l lut] [-m] [-i tile] [-c csv] [path]\n\n"
+		"  path      recording of Camera.record() or V4L2 device, synthetic frames if omitted\n"
+		"  -n        number of frames, default 300 (all of a recording)\n"
+		"  -s        synthetic or device resolution, default 640x480\n"
+		"  -l        raw 16 MiB lookup table, numpy colors.tofile(), default: 1=orange 2=blue\n"
+		"  -m        enable open/close morphology of color 1\n"
+		"  -i        incremental threshold with tile size\n"
+		"  -c        also write the per stage totals to a CSV file\n",
+		name);
+}
+
+int main(int argc, char **argv) {
+	int frames = 0;
+	int w = 640, h = 480;
+	int tile = 0;
+	int morph = 0;
+	const char *lut = NULL;
+	const char *path = NULL;
+	const char *csv = NULL;
+	int opt, i, j, c;
+
+	while ((opt = getopt(argc, argv, "n:s:l:mi:c:")) != -1) {
+		switch (opt) {
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 's':
+			if (sscanf(optarg, "%dx%d", &w, &h) != 2) {
+				usage(argv[0]);
+				return 2;
+			}
+			break;
+		case 'l':
+			lut = optarg;
+			break;
+		case 'm':
+			morph = 1;
+			break;
+		case 'i':
+			tile = atoi(optarg);
+			break;
+		case 'c':
+			csv = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (optind < argc) {
+		path = argv[optind];
+	}
+	if (tile < 0 || tile % 8) {
+		fprintf(stderr, "tile must be a multiple of 8\n");
+		return 2;
+	}
+
+	cmv_config *cfg = (cmv_config *)malloc(sizeof(cmv_config));
+	if (cfg == NULL) {
+		perror("cmv_config");
+		return 1;
+	}
+	cmv_config_init(cfg);
+	if (lut != NULL) {
+		if (load_lut(cfg, lut)) {
+			perror(lut);
+			return 1;
+		}
+	} else {
+		default_lut(cfg);
+	}
+	for (c = 1; c < COLOR_COUNT; c++) {
+		cfg->classes[c].min_area = 10;
+	}
+	if (morph) {
+		cfg->classes[1].open_w = 2;
+		cfg->classes[1].close_w = 3;
+		cfg->classes[1].open_h = 1;
+		cfg->classes[1].close_h = 2;
+	}
+	cfg->inc_tile = tile;
+	cmv_config_changed(cfg);
+
+	cmv_capture cap;
+	cmv_capture_init(&cap);
+	unsigned char *synthetic = NULL;
+	if (path != NULL) {
+		if (cmv_capture_open(&cap, path, w, h, 30, 3)) {
+			fprintf(stderr, "%s: %s\n", path, errno == EBADMSG ? "not a YUYV recording" : strerror(errno));
+			return 1;
+		}
+		w = cap.width;
+		h = cap.height;
+		if (cmv_capture_start(&cap)) {
+			perror("start");
+			return 1;
+		}
+	} else {
+		synthetic = (unsigned char *)malloc((size_t)w * h * 2);
+	}
+	if (path == NULL && frames == 0) {
+		frames = 300;
+	}
+
+	cmv_vision *vis = cmv_create(cfg, w, h);
+	if (vis == NULL || (path == NULL && synthetic == NULL)) {
+		fprintf(stderr, "Unsupported resolution %dx%d or out of memory\n", w, h);
+		return 1;
+	}
+
+	cmv_perf perf;
+	cmv_perf_init(&perf);
+	if (cmv_perf_open(&perf) == 0) {
+		fprintf(stderr, "No hardware counters (perf_event_paranoid or no PMU), timing only\n");
+	}
+	vis->perf = &perf;
+	double blobs = 0, runs = 0;
+	int n;
+
+	for (n = 0; frames == 0 || n < frames; n++) {
+		const unsigned char *frame;
+		struct v4l2_buffer buffer;
+
+		if (synthetic != NULL) {
+			synthetic_frame(synthetic, w, h, n);
+			frame = synthetic;
+		} else {
+			if (cmv_capture_wait(&cap, 2000) <= 0 || cmv_capture_dequeue(&cap, &buffer)) {
+				if (errno != ENODATA) {
+					perror(path);
+				}
+				break;
+			}
+			frame = (const unsigned char *)cap.buffers[buffer.index].start;
+		}
+
+		cmv_segment(vis, frame);
+
+		runs += vis->run_c;
+		for (c = 0; c < COLOR_COUNT; c++) {
+			blobs += vis->colors[c].num;
+		}
+		if (synthetic == NULL) {
+			cmv_capture_release(&cap, &buffer);
+		}
+	}
+
+	if (n == 0) {
+		fprintf(stderr, "No frames\n");
+		return 1;
+	}
+
+	double total = 0;
+	printf("%d frames %dx%d, %.0f runs/frame, %.1f blobs/frame\n", n, w, h, runs / n, blobs / n);
+	printf("%-10s %10s %10s %10s", "stage", "mean us", "min us", "max us");
+	for (j = 0; j < CMV_PERF_COUNT; j++) {
+		if (perf.available & (1 << j)) {
+			printf(" %13s", cmv_perf_names[j]);
+		}
+	}
+	printf("\n");
+	for (i = 0; i < CMV_STAGE_COUNT; i++) {
+		const cmv_stage_stats *s = &perf.stages[i];
+		// means are per frame, stages that did not run count as 0
+		printf("%-10s %10.1f %10.1f %10.1f", cmv_stage_names[i], s->total_us / n, s->min_us, s->max_us);
+		for (j = 0; j < CMV_PERF_COUNT; j++) {
+			if (perf.available & (1 << j)) {
+				printf(" %13.0f", (double)s->counts[j] / n);
+			}
+		}
+		printf("\n");
+		total += s->total_us;
+	}
+	printf("%-10s %10.1f\n", "total", total / n);
+
+	if (csv != NULL) {
+		FILE *f = fopen(csv, "w");
+		if (f == NULL || cmv_perf_write_csv(&perf, f) || fclose(f)) {
+			perror(csv);
+			return 1;
+		}
+	}
+
+	cmv_perf_close(&perf);
+	cmv_destroy(vis);
+	cmv_capture_close(&cap);
+	cmv_config_free(cfg);
+	free(cfg);
+	free(synthetic);
+	return 0;
+}
@@ -0,0 +1,1300 @@
+// libcmvision - color segmentation engine of pyCMVision
+//
+// The run and region stages are the ones of CMVision, with their
+// original comments.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "cmvision.h"
+#include "cmv_perf.h"
+
+#define PERF_STAGE(vis, stage) if ((vis)->perf) cmv_perf_stage((vis)->perf, stage)
+
+#define max(a,b) \
+	({ __typeof__ (a) _a = (a); \
+		__typeof__ (b) _b = (b); \
+		_a > _b ? _a : _b; })
+	 
+#define min(a,b) \
+	({ __typeof__ (a) _a = (a); \
+		__typeof__ (b) _b = (b); \
+		_a < _b ? _a : _b; })
+
+void cmv_config_init(cmv_config *cfg) {
+	//everything active, no color tracked
+	int i;
+	memset(cfg, 0, sizeof(*cfg));
+	for (i = 0; i <= COLOR_COUNT; i++) {
+		cfg->classes[i].min_area = MAX_INT;
+		cfg->classes[i].close_w = -1;
+	}
+	memset(cfg->pixel_active, 1, sizeof(cfg->pixel_active));
+	cfg->loc_step = 1;
+	cfg->max_runs = MAX_RUNS;
+	cfg->max_regions = MAX_REG;
+}
+
+void cmv_config_free(cmv_config *cfg) {
+	free(cfg->loc_r);
+	free(cfg->loc_phi);
+	cfg->loc_r = NULL;
+	cfg->loc_phi = NULL;
+}
+
+void cmv_config_changed(cmv_config *cfg) {
+	// has to be called after changing the lookup table, active pixels or
+	// tracked colors, so incremental results are not reused
+	int i;
+	cfg->version++;
+	cfg->morph = 0;
+	cfg->morph_open_h = 0;
+	cfg->morph_close_h = 0;
+	cfg->low_priority = 0;
+	for (i = 0; i < COLOR_COUNT; i++) {
+		cmv_class *c = &cfg->classes[i];
+		if (c->low_priority && c->min_area < MAX_INT) cfg->low_priority = 1;
+		if (c->open_w > 1 || c->close_w > 0 || c->open_h) cfg->morph = 1;
+		if (c->open_h) cfg->morph_open_h = 1;
+		if (c->close_h > cfg->morph_close_h) cfg->morph_close_h = c->close_h;
+	}
+}
+
+int cmv_set_locations(cmv_config *cfg, const unsigned short *r, const unsigned short *phi, int w, int h, int step) {
+	//copy location tables of w x h samples taken every step pixels, -1 if out of memory
+	size_t size = (size_t)w * h;
+	unsigned short *loc_r = (unsigned short *)malloc(size * sizeof(unsigned short));
+	unsigned short *loc_phi = (unsigned short *)malloc(size * sizeof(unsigned short));
+	if (loc_r == NULL || loc_phi == NULL) {
+		free(loc_r);
+		free(loc_phi);
+		return -1;
+	}
+	memcpy(loc_r, r, size * sizeof(unsigned short));
+	memcpy(loc_phi, phi, size * sizeof(unsigned short));
+
+	cmv_config_free(cfg);
+	cfg->loc_r = loc_r;
+	cfg->loc_phi = loc_phi;
+	cfg->loc_w = w;
+	cfg->loc_h = h;
+	cfg->loc_step = step;
+	return 0;
+}
+
+void cmv_init(cmv_vision *vis, cmv_config *cfg) {
+	//initialize pipeline state using cfg, no buffers yet
+	vis->config = cfg;
+	vis->width = 0;
+	vis->height = 0;
+	vis->segmented = NULL;
+	vis->segmented_owned = 0;
+	vis->rle = NULL;
+	vis->rle_cap = 0;
+	vis->regions = NULL;
+	vis->regions_cap = 0;
+	vis->run_c = 0;
+	vis->region_c = 0;
+	vis->max_area = 0;
+	vis->passes = 0;
+	memset(vis->colors, 0, sizeof(vis->colors));
+	memset(vis->hist, 0, sizeof(vis->hist));
+	memset(vis->color_counts, 0, sizeof(vis->color_counts));
+	vis->inc_tile = 0;
+	vis->inc_valid = 0;
+	vis->inc_prev = NULL;
+	vis->inc_dirty = NULL;
+	vis->inc_runs = NULL;
+	vis->inc_runs_cap = 0;
+	vis->dirty_ratio = 0;
+	vis->degraded = 0;
+	vis->decimate = 0;
+	vis->frame_us = 0;
+	vis->perf = NULL;
+}
+
+int cmv_set_size(cmv_vision *vis, int w, int h) {
+	//allocate buffers for w x h frames, -1 if size is not supported or out of memory
+	if (w <= 0 || w > MAX_WIDTH || h <= 0 || h > MAX_HEIGHT || w % 2) {
+		return -1;
+	}
+	// one extra row for the row terminator of cmv_encode_runs
+	unsigned char *segmented = (unsigned char *)calloc((size_t)w * (h + 1), sizeof(unsigned char));
+	if (segmented == NULL) {
+		return -1;
+	}
+	if (vis->rle == NULL || vis->regions == NULL) {
+		vis->rle_cap = min(CMV_INITIAL_RUNS, vis->config->max_runs);
+		vis->regions_cap = min(CMV_INITIAL_REG, vis->config->max_regions);
+		free(vis->rle);
+		free(vis->regions);
+		vis->rle = (run *)malloc((vis->rle_cap + 1) * sizeof(run));
+		vis->regions = (region *)malloc(vis->regions_cap * sizeof(region));
+		if (vis->rle == NULL || vis->regions == NULL) {
+			free(segmented);
+			return -1;
+		}
+	}
+	if (vis->segmented_owned) {
+		free(vis->segmented);
+	}
+	vis->segmented = segmented;
+	vis->segmented_owned = 1;
+	vis->width = w;
+	vis->height = h;
+	vis->run_c = 0;
+	vis->region_c = 0;
+	memset(vis->colors, 0, sizeof(vis->colors));
+	vis->inc_tile = 0;
+	vis->inc_valid = 0;
+	return 0;
+}
+
+void cmv_free(cmv_vision *vis) {
+	if (vis->segmented_owned) {
+		free(vis->segmented);
+	}
+	free(vis->inc_prev);
+	free(vis->inc_dirty);
+	free(vis->inc_runs);
+	free(vis->rle);
+	free(vis->regions);
+	vis->segmented = NULL;
+	vis->inc_prev = NULL;
+	vis->inc_dirty = NULL;
+	vis->inc_runs = NULL;
+	vis->inc_runs_cap = 0;
+	vis->rle = NULL;
+	vis->regions = NULL;
+	vis->rle_cap = vis->regions_cap = 0;
+}
+
+static int grow_runs(cmv_vision *vis, int need) {
+	//room for need runs within the cap, -1 if the cap is reached or out of memory
+	int cap = max(vis->rle_cap, 1024);
+	if (need > vis->config->max_runs) {
+		return -1;
+	}
+	while (cap < need) cap *= 2;
+	cap = min(cap, vis->config->max_runs);
+	run *rle = (run *)realloc(vis->rle, (cap + 1) * sizeof(run));
+	if (rle == NULL) {
+		return -1;
+	}
+	vis->rle = rle;
+	vis->rle_cap = cap;
+	return 0;
+}
+
+static int grow_regions(cmv_vision *vis, int need) {
+	//room for need regions within the cap, -1 if the cap is reached or out of memory
+	int cap = max(vis->regions_cap, 256);
+	if (need > vis->config->max_regions) {
+		return -1;
+	}
+	while (cap < need) cap *= 2;
+	cap = min(cap, vis->config->max_regions);
+	region *regions = (region *)realloc(vis->regions, cap * sizeof(region));
+	if (regions == NULL) {
+		return -1;
+	}
+	vis->regions = regions;
+	vis->regions_cap = cap;
+	return 0;
+}
+
+void cmv_use_segmented(cmv_vision *vis, unsigned char *buf) {
+// Continues in a caller owned buffer of width * (height + 1) bytes, which
+// has to outlive its use by vis. The current classification is copied
+// over, incremental mode and inactive pixels keep their old values.
+	if (buf == vis->segmented) {
+		return;
+	}
+	if (vis->segmented != NULL) {
+		memcpy(buf, vis->segmented, (size_t)vis->width * vis->height);
+	}
+	if (vis->segmented_owned) {
+		free(vis->segmented);
+	}
+	vis->segmented = buf;
+	vis->segmented_owned = 0;
+}
+
+cmv_vision *cmv_create(cmv_config *cfg, int w, int h) {
+	//allocate pipeline for w x h frames, NULL on failure
+	cmv_vision *vis = (cmv_vision *)malloc(sizeof(cmv_vision));
+	if (vis == NULL) {
+		return NULL;
+	}
+	cmv_init(vis, cfg);
+	if (cmv_set_size(vis, w, h)) {
+		free(vis);
+		return NULL;
+	}
+	return vis;
+}
+
+void cmv_destroy(cmv_vision *vis) {
+	if (vis != NULL) {
+		cmv_free(vis);
+		free(vis);
+	}
+}
+
+void cmv_locate(const cmv_config *cfg, float x, float y, unsigned short *r, unsigned short *phi) {
+// Maps image coordinate to polar coordinate. Full size tables are
+// sampled at the nearest pixel, coarse grids are interpolated
+// bilinearly. Angles wrap around at 65536, so they are interpolated
+// as signed offsets from the top left sample.
+	*r = 0;
+	*phi = 0;
+	if (cfg->loc_r == NULL) {
+		return;
+	}
+
+	int gw = cfg->loc_w;
+	if (cfg->loc_step == 1) {
+		int cx = (int)round(x);
+		int cy = (int)round(y);
+		if (cx >= 0 && cx < gw && cy >= 0 && cy < cfg->loc_h) {
+			*r = cfg->loc_r[cy * gw + cx];
+			*phi = cfg->loc_phi[cy * gw + cx];
+		}
+		return;
+	}
+
+	float gx = x / cfg->loc_step;
+	float gy = y / cfg->loc_step;
+	int x0 = min(max((int)gx, 0), gw - 2);
+	int y0 = min(max((int)gy, 0), cfg->loc_h - 2);
+	float fx = min(max(gx - x0, 0.0f), 1.0f);
+	float fy = min(max(gy - y0, 0.0f), 1.0f);
+	int i = y0 * gw + x0;
+
+	float w00 = (1 - fx) * (1 - fy);
+	float w01 = fx * (1 - fy);
+	float w10 = (1 - fx) * fy;
+	float w11 = fx * fy;
+
+	unsigned short *t = cfg->loc_r;
+	*r = (unsigned short)(w00 * t[i] + w01 * t[i + 1] + w10 * t[i + gw] + w11 * t[i + gw + 1] + 0.5f);
+
+	t = cfg->loc_phi;
+	int base = t[i];
+	float d = w01 * (short)(t[i + 1] - base) + w10 * (short)(t[i + gw] - base) + w11 * (short)(t[i + gw + 1] - base);
+	*phi = (unsigned short)((base + (int)lroundf(d)) & 0xffff);
+}
+
+void cmv_encode_runs(cmv_vision *vis) {
+// Changes the flat array version of the thresholded image into a run
+// length encoded version, which speeds up later processing since we
+// only have to look at the points where values change.
+	unsigned char m, save;
+	unsigned char *row = NULL;
+	int x, y, j, l;
+	run r;
+	unsigned char *map = vis->segmented;
+	run *rle = vis->rle;
+	cmv_class *cls = vis->config->classes;
+	
+	int w = vis->width;
+	int h = vis->height;
+
+	r.next = 0;
+
+	// initialize terminator restore
+	save = map[0];
+
+	j = 0;
+	for(y = 0; y < h; y++){
+		int start = j;
+		row = &map[y * w];
+
+		// restore previous terminator and store next
+		// one in the first pixel on the next row
+		row[0] = save;
+		save = row[w];
+		row[w] = 255;
+		
+		r.y = y;
+
+		x = 0;
+		while(x < w){
+			m = row[x];
+			r.x = x;
+
+			l = x;
+			while(row[x] == m) x++;
+
+			if(cls[m].min_area < MAX_INT || x >= w ) {
+				if(j >= vis->rle_cap) {
+					if(grow_runs(vis, j + 1)) {
+						// out of runs, leave out this row and the rest of the frame
+						row[w] = save;
+						vis->run_c = start;
+						vis->degraded |= CMV_TRUNCATED_RUNS;
+						return;
+					}
+					rle = vis->rle;
+				}
+				r.color = m;
+				r.width = x - l;
+				r.parent = j;
+				rle[j++] = r;
+			}
+		}
+	}
+
+	vis->run_c = j;
+}
+
+void cmv_connect_components(cmv_vision *vis) {
+// Connect components using four-connecteness so that the runs each
+// identify the global parent of the connected region they are a part
+// of.	It does this by scanning adjacent rows and merging where
+// similar colors overlap.	Used to be union by rank w/ path
+// compression, but now it just uses path compression as the global
+// parent index, a simpler rank bound in practice.
+// WARNING: This code is complicated.	I'm pretty sure it's a correct
+//	 implementation, but minor changes can easily cause big problems.
+//	 Read the papers on this library and have a good understanding of
+//	 tree-based union find before you touch it
+	int l1, l2;
+	run r1, r2;
+	int i, j, s;
+	int num = vis->run_c;
+	run *map = vis->rle;
+	cmv_class *cls = vis->config->classes;
+
+	// guard entry, the scan below reads one run past the end
+	map[num].y = -1;
+	map[num].x = map[num].width = 0;
+
+	// l2 starts on first scan line, l1 starts on second
+	l2 = 0;
+	l1 = 1;
+	while(map[l1].y == 0) l1++; // skip first line
+
+	// Do rest in lock step
+	r1 = map[l1];
+	r2 = map[l2];
+	s = l1;
+	while(l1 < num){
+		if(r1.color==r2.color && cls[r1.color].min_area < MAX_INT){
+			if((r2.x<=r1.x && r1.x<r2.x+r2.width) || (r1.x<=r2.x && r2.x<r1.x+r1.width)){
+				if(s != l1){
+					// if we didn't have a parent already, just take this one
+					map[l1].parent = r1.parent = r2.parent;
+					s = l1;
+				} else if(r1.parent != r2.parent) {
+					// otherwise union two parents if they are different
+
+					// find terminal roots of each path up tree
+					i = r1.parent;
+					while(i != map[i].parent) i = map[i].parent;
+					j = r2.parent;
+					while(j != map[j].parent) j = map[j].parent;
+
+					// union and compress paths; use smaller of two possible
+					// representative indicies to preserve DAG property
+					if(i < j) {
+						map[j].parent = i;
+						map[l1].parent = map[l2].parent = r1.parent = r2.parent = i;
+					} else {
+						map[i].parent = j;
+						map[l1].parent = map[l2].parent = r1.parent = r2.parent = j;
+					}
+				}
+			}
+		}
+
+		// Move to next point where values may change
+		i = (r2.x + r2.width) - (r1.x + r1.width);
+		if(i >= 0) r1 = map[++l1];
+		if(i <= 0) r2 = map[++l2];
+	}
+
+	// Now we need to compress all parent paths
+	for(i=0; i<num; i++){
+		j = map[i].parent;
+		map[i].parent = map[j].parent;
+	}
+}
+
+static void index_rows(cmv_vision *vis) {
+	// row_start[y] is the first run of row y, row_start[h] the run count
+	int i, y = 0;
+	for (i = 0; i < vis->run_c; i++) {
+		while (y <= vis->rle[i].y) vis->row_start[y++] = i;
+	}
+	while (y <= vis->height) vis->row_start[y++] = vis->run_c;
+}
+
+static int run_overlaps(cmv_vision *vis, run *r, int *k, int end) {
+	// advances k over runs of one row ending before r, returns 1 if any
+	// run of the same color overlaps r
+	run *rle = vis->rle;
+	int i;
+	while (*k < end && rle[*k].x + rle[*k].width <= r->x) (*k)++;
+	for (i = *k; i < end && rle[i].x < r->x + r->width; i++) {
+		if (rle[i].color == r->color) return 1;
+	}
+	return 0;
+}
+
+void cmv_morph_runs(cmv_vision *vis) {
+// Morphological open/close done directly on the runs. Horizontally,
+// runs shorter than open_w are dropped and gaps up to close_w between
+// runs of the same color are bridged, which removes the runs in the
+// gap. Vertically, runs without a same colored run overlapping them in
+// the row above or below are dropped when open_h is set. The last run
+// of a row must still reach the row end, so a dropped terminator is
+// kept with the untracked CMV_VOID color.
+	run *rle = vis->rle;
+	cmv_class *color = vis->config->classes;
+	int num = vis->run_c;
+	int last[COLOR_COUNT];
+	int i, j, k, o, y, c;
+	int w = vis->width;
+	run r;
+
+	o = 0;
+	y = -1;
+	for (i = 0; i < num; i++) {
+		r = rle[i];
+		if (r.y != y) {
+			y = r.y;
+			for (c = 0; c < COLOR_COUNT; c++) last[c] = -1;
+		}
+		c = r.color;
+		if (c < COLOR_COUNT && r.width < color[c].open_w) {
+			if (r.x + r.width < w) continue;
+			r.color = c = CMV_VOID;
+		}
+		if (c < COLOR_COUNT && last[c] >= 0 && r.x - (rle[last[c]].x + rle[last[c]].width) <= color[c].close_w) {
+			// bridge the gap, runs in between are covered by this color
+			j = last[c];
+			rle[j].width = r.x + r.width - rle[j].x;
+			for (k = 0; k < COLOR_COUNT; k++) {
+				if (last[k] > j) last[k] = -1;
+			}
+			o = j + 1;
+			continue;
+		}
+		r.parent = o;
+		if (c < COLOR_COUNT) last[c] = o;
+		rle[o++] = r;
+	}
+	vis->run_c = num = o;
+
+	if (!vis->config->morph_open_h) return;
+
+	// mark isolated runs first (next is unused until cmv_extract_regions),
+	// then drop them, so that dropping does not isolate other runs
+	index_rows(vis);
+	for (y = 0; y < vis->height; y++) {
+		int above = y > 0 ? vis->row_start[y - 1] : 0;
+		int below = vis->row_start[y + 1];
+		int above_end = vis->row_start[y];
+		int below_end = y + 1 < vis->height ? vis->row_start[y + 2] : below;
+		for (i = vis->row_start[y]; i < vis->row_start[y + 1]; i++) {
+			r = rle[i];
+			rle[i].next = 0;
+			if (r.color < COLOR_COUNT && color[r.color].open_h) {
+				int a = run_overlaps(vis, &r, &above, above_end);
+				int b = run_overlaps(vis, &r, &below, below_end);
+				rle[i].next = !a && !b;
+			}
+		}
+	}
+	o = 0;
+	for (i = 0; i < num; i++) {
+		r = rle[i];
+		if (r.next) {
+			if (r.x + r.width < w) continue;
+			r.color = CMV_VOID;
+			r.next = 0;
+		}
+		r.parent = o;
+		rle[o++] = r;
+	}
+	vis->run_c = o;
+}
+
+void cmv_close_vertical(cmv_vision *vis) {
+// Unions components of runs which are separated by at most close_h
+// rows of other colors. Has to run after cmv_connect_components, roots
+// keep the smallest index so the parent pointers stay a DAG.
+	run *rle = vis->rle;
+	cmv_class *color = vis->config->classes;
+	int i, j, d, y, k, a, b;
+
+	index_rows(vis);
+	for (d = 2; d <= vis->config->morph_close_h + 1; d++) {
+		for (y = 0; y + d < vis->height; y++) {
+			k = vis->row_start[y + d];
+			for (i = vis->row_start[y]; i < vis->row_start[y + 1]; i++) {
+				if (rle[i].color >= COLOR_COUNT || color[rle[i].color].close_h < d - 1) continue;
+				if (!run_overlaps(vis, &rle[i], &k, vis->row_start[y + d + 1])) continue;
+				for (j = k; j < vis->row_start[y + d + 1] && rle[j].x < rle[i].x + rle[i].width; j++) {
+					if (rle[j].color != rle[i].color) continue;
+					a = i;
+					while (a != rle[a].parent) a = rle[a].parent;
+					b = j;
+					while (b != rle[b].parent) b = rle[b].parent;
+					if (a < b) rle[b].parent = a;
+					else rle[a].parent = b;
+				}
+			}
+		}
+	}
+
+	// compress again, parents always precede their children
+	for (i = 0; i < vis->run_c; i++) {
+		rle[i].parent = rle[rle[i].parent].parent;
+	}
+}
+
+static inline int range_sum(int x, int w) {
+	//foo bar
+	return(w*(2*x + w-1) / 2);
+}
+
+void cmv_extract_regions(cmv_vision *vis) {
+// Takes the list of runs and formats them into a region table,
+// gathering the various statistics along the way.	num is the number
+// of runs in the rmap array, and the number of unique regions in
+// reg[] (bounded by max_reg) is returned.	Implemented as a single
+// pass over the array of runs.
+	int b, i, n, a;
+	int num = vis->run_c;
+	run *rmap = vis->rle;
+	region *reg = vis->regions;
+	run r;
+	n = 0;
+
+	for(i=0; i<num; i++){
+		if( vis->config->classes[rmap[i].color].min_area < MAX_INT){
+			r = rmap[i];
+			if(r.parent == i){
+				if(n >= vis->regions_cap) {
+					if(grow_regions(vis, n + 1)) {
+						// out of regions, the runs of this one are left out
+						rmap[i].parent = -1;
+						vis->degraded |= CMV_TRUNCATED_REGIONS;
+						continue;
+					}
+					reg = vis->regions;
+				}
+				// Add new region if this run is a root (i.e. self parented)
+				rmap[i].parent = b = n;	// renumber to point to region id
+				reg[b].color = r.color;
+				reg[b].area = r.width;
+				reg[b].x1 = r.x;
+				reg[b].y1 = r.y;
+				reg[b].x2 = r.x + r.width;
+				reg[b].y2 = r.y;
+				reg[b].cen_x = range_sum(r.x,r.width);
+				reg[b].cen_y = r.y * r.width;
+				reg[b].run_start = i;
+				reg[b].iterator_id = i; // temporarily use to store last run
+				n++;
+			} else {
+				// Otherwise update region stats incrementally
+				b = rmap[r.parent].parent;
+				rmap[i].parent = b; // update parent to identify region id
+				if(b < 0) continue;
+				reg[b].area += r.width;
+				reg[b].x2 = max(r.x + r.width,reg[b].x2);
+				reg[b].x1 = min((int)r.x,reg[b].x1);
+				reg[b].y2 = r.y; // last set by lowest run
+				reg[b].cen_x += range_sum(r.x,r.width);
+				reg[b].cen_y += r.y * r.width;
+				// set previous run to point to this one as next
+				rmap[reg[b].iterator_id].next = i;
+				reg[b].iterator_id = i;
+			}
+		}
+	}
+
+	// calculate centroids from stored sums
+	for(i=0; i<n; i++){
+		a = reg[i].area;
+		reg[i].cen_x = (float)reg[i].cen_x / a;
+		reg[i].cen_y = (float)reg[i].cen_y / a;
+		rmap[reg[i].iterator_id].next = 0; // -1;
+		reg[i].iterator_id = 0;
+		reg[i].x2--; // change to inclusive range
+	}
+	vis->region_c = n;
+}
+
+static int accept_region(const cmv_config *cfg, const cmv_class *c, region *p) {
+	// returns 0 if the region fails a filter of its color
+	float bw = p->x2 - p->x1 + 1;
+	float bh = p->y2 - p->y1 + 1;
+	unsigned short r, phi;
+
+	if (c->max_area && p->area > c->max_area) return 0;
+	if (c->min_aspect && bw < c->min_aspect * bh) return 0;
+	if (c->max_aspect && bw > c->max_aspect * bh) return 0;
+	if (c->min_fill && p->area < c->min_fill * bw * bh) return 0;
+	if (c->max_y && (p->cen_y < c->min_y || p->cen_y > c->max_y)) return 0;
+	if (c->max_r && cfg->loc_r != NULL) {
+		cmv_locate(cfg, p->cen_x, p->cen_y, &r, &phi);
+		if (r < c->min_r || r > c->max_r) return 0;
+	}
+	return 1;
+}
+
+void cmv_separate_regions(cmv_vision *vis) {
+// Splits the various regions in the region table a separate list for
+// each color.	The lists are threaded through the table using the
+// region's 'next' field.	Returns the maximal area of the regions,
+// which can be used later to speed up sorting.
+	region *p = NULL;
+	int i;
+	int c;
+	int area;
+	int num = vis->region_c;
+	region *reg = vis->regions;
+	color_class_state *color = vis->colors;
+	cmv_class *cls = vis->config->classes;
+
+	// clear out the region list head table
+	for(i=0; i<COLOR_COUNT; i++) {
+		color[i].list = NULL;
+		color[i].num	= 0;
+		color[i].sorted = 0;
+	}
+	// step over the table, adding successive
+	// regions to the front of each list
+	vis->max_area = 0;
+	for(i=0; i<num; i++){
+		p = &reg[i];
+		c = p->color;
+		area = p->area;
+
+		if(area >= cls[c].min_area && (!cls[c].filter || accept_region(vis->config, &cls[c], p))){
+			if(area > vis->max_area) vis->max_area = area;
+			color[c].num++;
+			p->next = color[c].list;
+			color[c].list = p;
+		}
+	}
+}
+
+region *cmv_sort_regions(region *list, int passes) {
+// Sorts a list of regions by their area field.
+// Uses a linked list based radix sort to process the list.
+	region *tbl[CMV_RADIX]={NULL}, *p=NULL, *pn=NULL;
+	int slot, shift;
+	int i, j;
+
+	// Handle trivial cases
+	if(!list || !list->next) return(list);
+
+	// Initialize table
+	for(j=0; j<CMV_RADIX; j++) tbl[j] = NULL;
+
+	for(i=0; i<passes; i++){
+		// split list into buckets
+		shift = CMV_RBITS * i;
+		p = list;
+		while(p){
+			pn = p->next;
+			slot = ((p->area) >> shift) & CMV_RMASK;
+			p->next = tbl[slot];
+			tbl[slot] = p;
+			p = pn;
+		}
+
+		// integrate back into partially ordered list
+		list = NULL;
+		for(j=0; j<CMV_RADIX; j++){
+			p = tbl[j];
+			tbl[j] = NULL; // clear out table for next pass
+			while(p){
+				pn = p->next;
+				p->next = list;
+				list = p;
+				p = pn;
+			}
+		}
+	}
+
+	return(list);
+}
+
+region *cmv_sorted_list(cmv_vision *vis, int c) {
+	// sorts the list of color only once per frame, so every caller sees
+	// equal sized regions in the same order
+	if (!vis->colors[c].sorted) {
+		vis->colors[c].list = cmv_sort_regions(vis->colors[c].list, vis->passes);
+		vis->colors[c].sorted = 1;
+	}
+	return vis->colors[c].list;
+}
+
+void cmv_threshold(cmv_vision *vis, const unsigned char *f) {
+// Maps every active YUYV pixel pair to color ids through the lookup
+// table. When statistics are enabled the same pass also builds the
+// Y (and U/V) histogram and the per color pixel counts.
+	int w = vis->width;
+	int h = vis->height;
+	int xy;
+	int y1, y2, u, v;
+	unsigned char *segmented = vis->segmented;
+	const cmv_config *cfg = vis->config;
+	const unsigned char *lookup = cfg->colors_lookup;
+
+	if (!cfg->stats) {
+		for (xy = 0; xy < w*h; xy+=2) {
+			if (cfg->pixel_active[xy]) {
+				y1 = f[2*xy];
+				u = f[2*xy+1];
+				y2 = f[2*xy+2];
+				v = f[2*xy+3];
+				segmented[xy] = lookup[y1 + (u << 8) + (v << 16)];
+				segmented[xy+1] = lookup[y2 + (u << 8) + (v << 16)];
+			}
+		}
+		return;
+	}
+
+	unsigned int *hist_y = vis->hist[0];
+	unsigned int *hist_u = vis->hist[1];
+	unsigned int *hist_v = vis->hist[2];
+	unsigned int *counts = vis->color_counts;
+	int uv = cfg->stats_uv;
+	memset(vis->hist, 0, sizeof(vis->hist));
+	memset(vis->color_counts, 0, sizeof(vis->color_counts));
+
+	for (xy = 0; xy < w*h; xy+=2) {
+		if (cfg->pixel_active[xy]) {
+			y1 = f[2*xy];
+			u = f[2*xy+1];
+			y2 = f[2*xy+2];
+			v = f[2*xy+3];
+			segmented[xy] = lookup[y1 + (u << 8) + (v << 16)];
+			segmented[xy+1] = lookup[y2 + (u << 8) + (v << 16)];
+			hist_y[y1]++;
+			hist_y[y2]++;
+			counts[segmented[xy]]++;
+			counts[segmented[xy+1]]++;
+			if (uv) {
+				hist_u[u]++;
+				hist_v[v]++;
+			}
+		}
+	}
+}
+
+static int alloc_incremental(cmv_vision *vis) {
+	//allocate previous frame, tile flags and run cache for current resolution and tile size
+	free(vis->inc_prev);
+	free(vis->inc_dirty);
+	vis->inc_tile = vis->config->inc_tile;
+	vis->inc_tiles_x = (vis->width + vis->inc_tile - 1) / vis->inc_tile;
+	vis->inc_tiles_y = (vis->height + vis->inc_tile - 1) / vis->inc_tile;
+	vis->inc_prev = (unsigned char *)malloc(vis->width * vis->height * 2);
+	vis->inc_dirty = (unsigned char *)malloc(vis->inc_tiles_x * vis->inc_tiles_y);
+	vis->inc_valid = 0;
+	if (vis->inc_prev == NULL || vis->inc_dirty == NULL) {
+		vis->inc_tile = 0;
+		return -1;
+	}
+	return 0;
+}
+
+static int tile_sad_exceeds(const unsigned char *a, const unsigned char *b, int stride, int bytes, int rows, unsigned int limit) {
+	// sum of absolute differences of a tile, stops as soon as it is over limit
+	unsigned int sad = 0;
+	int i, y;
+	for (y = 0; y < rows; y++, a += stride, b += stride) {
+		i = 0;
+#ifdef __SSE2__
+		__m128i acc = _mm_setzero_si128();
+		for (; i + 16 <= bytes; i += 16) {
+			acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i))));
+		}
+		sad += _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#endif
+		for (; i < bytes; i++) {
+			sad += abs(a[i] - b[i]);
+		}
+		if (sad > limit) return 1;
+	}
+	return 0;
+}
+
+void cmv_threshold_incremental(cmv_vision *vis, const unsigned char *f) {
+// Compares every tile with the previous frame and classifies only the
+// changed ones. Unchanged tiles keep their classification from earlier
+// frames, a changed tile also replaces its previous frame content, so
+// slow drift is still detected once it adds up.
+	int w = vis->width;
+	int h = vis->height;
+	int t = vis->inc_tile;
+	int tx, ty, x, y, xy, x1, y1;
+	int y_1, y_2, u, v;
+	int dirty = 0;
+	unsigned char *segmented = vis->segmented;
+	const cmv_config *cfg = vis->config;
+	const unsigned char *lookup = cfg->colors_lookup;
+	unsigned char *d = vis->inc_dirty;
+
+	for (ty = 0; ty < vis->inc_tiles_y; ty++) {
+		y1 = min(ty * t + t, h);
+		vis->inc_row_dirty[ty] = 0;
+		for (tx = 0; tx < vis->inc_tiles_x; tx++, d++) {
+			x = tx * t;
+			x1 = min(x + t, w);
+			*d = !vis->inc_valid || tile_sad_exceeds(&f[2 * (ty * t * w + x)], &vis->inc_prev[2 * (ty * t * w + x)],
+				2 * w, 2 * (x1 - x), y1 - ty * t, (unsigned int)cfg->inc_threshold * 2 * (x1 - x) * (y1 - ty * t));
+			if (!*d) continue;
+
+			dirty++;
+			vis->inc_row_dirty[ty] = 1;
+			for (y = ty * t; y < y1; y++) {
+				memcpy(&vis->inc_prev[2 * (y * w + x)], &f[2 * (y * w + x)], 2 * (x1 - x));
+				for (xy = y * w + x; xy < y * w + x1; xy += 2) {
+					if (cfg->pixel_active[xy]) {
+						y_1 = f[2*xy];
+						u = f[2*xy+1];
+						y_2 = f[2*xy+2];
+						v = f[2*xy+3];
+						segmented[xy] = lookup[y_1 + (u << 8) + (v << 16)];
+						segmented[xy+1] = lookup[y_2 + (u << 8) + (v << 16)];
+					}
+				}
+			}
+		}
+	}
+	vis->dirty_ratio = (float)dirty / (vis->inc_tiles_x * vis->inc_tiles_y);
+}
+
+void cmv_encode_runs_incremental(cmv_vision *vis) {
+// Like cmv_encode_runs, but rows of tile rows without changed tiles are
+// copied from the runs of the previous frame, and the result is cached
+// for the next frame before morphology or connecting change it.
+	unsigned char m, save;
+	unsigned char *row;
+	int x, y, j, l, i;
+	int start = 0;
+	int truncated = 0;
+	run r;
+	run *rle = vis->rle;
+	run *cache = vis->inc_runs;
+	cmv_class *cls = vis->config->classes;
+	int w = vis->width;
+	int h = vis->height;
+
+	r.next = 0;
+	j = 0;
+	for (y = 0; y < h; y++) {
+		start = j;
+		if (vis->inc_valid && !vis->inc_row_dirty[y / vis->inc_tile]) {
+			int n = vis->inc_row[y + 1] - vis->inc_row[y];
+			if (j + n > vis->rle_cap) {
+				if (grow_runs(vis, j + n)) {
+					truncated = 1;
+					break;
+				}
+				rle = vis->rle;
+			}
+			for (i = vis->inc_row[y]; i < vis->inc_row[y + 1]; i++) {
+				rle[j] = cache[i];
+				rle[j].parent = j;
+				rle[j].next = 0;
+				j++;
+			}
+		} else {
+			row = &vis->segmented[y * w];
+			save = row[w];
+			row[w] = 255;
+			r.y = y;
+			x = 0;
+			while (x < w) {
+				m = row[x];
+				r.x = x;
+				l = x;
+				while (row[x] == m) x++;
+				if (cls[m].min_area < MAX_INT || x >= w) {
+					if (j >= vis->rle_cap) {
+						if (grow_runs(vis, j + 1)) {
+							truncated = 1;
+							break;
+						}
+						rle = vis->rle;
+					}
+					r.color = m;
+					r.width = x - l;
+					r.parent = j;
+					rle[j++] = r;
+				}
+			}
+			row[w] = save;
+		}
+		if (truncated) {
+			break;
+		}
+		vis->inc_row[y] = start;
+	}
+
+	if (truncated) {
+		// leave out the incomplete row, truncated runs can not be reused
+		vis->run_c = start;
+		vis->degraded |= CMV_TRUNCATED_RUNS;
+		vis->inc_valid = 0;
+		return;
+	}
+	vis->run_c = j;
+	vis->inc_row[h] = j;
+	if (vis->inc_runs_cap < j) {
+		cache = (run *)realloc(vis->inc_runs, vis->rle_cap * sizeof(run));
+		if (cache == NULL) {
+			vis->inc_valid = 0;
+			return;
+		}
+		vis->inc_runs = cache;
+		vis->inc_runs_cap = vis->rle_cap;
+	}
+	memcpy(cache, rle, j * sizeof(run));
+	vis->inc_valid = 1;
+}
+
+int cmv_fill_blobs(cmv_vision *vis, int color, unsigned short *pout, int max_rows) {
+// Writes up to max_rows blobs of color, largest first, as rows of
+// [distance,angle,area,cen_x,cen_y,x1,x2,y1,y2]. Returns number of rows.
+	region *list = cmv_sorted_list(vis, color);
+	int rows = 0;
+	int n = 0;
+	unsigned short r, phi;
+
+	for (; list != NULL && rows < max_rows; list = list->next, rows++) {
+		cmv_locate(vis->config, list->cen_x, list->cen_y, &r, &phi);
+		
+		pout[n++] = r;
+		pout[n++] = phi;
+		pout[n++] = (unsigned short)min(65535 , list->area);
+		pout[n++] = (unsigned short)round(list->cen_x);
+		pout[n++] = (unsigned short)round(list->cen_y);
+		pout[n++] = (unsigned short)list->x1;
+		pout[n++] = (unsigned short)list->x2;
+		pout[n++] = (unsigned short)list->y1;
+		pout[n++] = (unsigned short)list->y2;
+	}
+	return rows;
+}
+
+static void mask_span(unsigned char *row, int x1, int x2, int packed) {
+	//set pixels x1..x2 of a mask row
+	if (!packed) {
+		memset(row + x1, 1, x2 - x1 + 1);
+		return;
+	}
+	int b1 = x1 >> 3, b2 = x2 >> 3;
+	unsigned char first = 0xff >> (x1 & 7);
+	unsigned char last = 0xff << (7 - (x2 & 7));
+	if (b1 == b2) {
+		row[b1] |= first & last;
+		return;
+	}
+	row[b1] |= first;
+	memset(row + b1 + 1, 0xff, b2 - b1 - 1);
+	row[b2] |= last;
+}
+
+static void mask_row(unsigned char *dst, const unsigned char *row, int w, int color, int packed) {
+// Full resolution mask row of the pixels having color, 8 pixels at a time:
+// bytes of color are xored to zero, the zero test leaves their high bit
+// and a multiply gathers the 8 high bits into one byte.
+	const unsigned long long ones = 0x0101010101010101ULL;
+	unsigned long long pattern = ones * color;
+	int x = 0, k;
+
+	for (; !packed && x + 8 <= w; x += 8) {
+		unsigned long long v;
+		memcpy(&v, row + x, 8);
+		v ^= pattern;
+		v = ~(((v & ones * 0x7f) + ones * 0x7f) | v) & ones * 0x80;
+		v >>= 7;
+		memcpy(dst + x, &v, 8);
+	}
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	for (; packed && x + 8 <= w; x += 8) {
+		unsigned long long v;
+		memcpy(&v, row + x, 8);
+		v ^= pattern;
+		v = ~(((v & ones * 0x7f) + ones * 0x7f) | v) & ones * 0x80;
+		dst[x >> 3] = (unsigned char)(((v >> 7) * 0x8040201008040201ULL) >> 56);
+	}
+#endif
+	for (; x < w; x++) {
+		if (!packed) {
+			dst[x] = row[x] == color;
+		} else {
+			k = 7 - (x & 7);
+			dst[x >> 3] |= (row[x] == color) << k;
+		}
+	}
+}
+
+static inline int scale_down(int v, unsigned long long inv) {
+	//v / scale without a division, exact for the 15 bit coordinates of runs
+	return (int)((v * inv) >> 32);
+}
+
+void cmv_class_masks(const cmv_vision *vis, const int *colors, int n, int scale, int packed, unsigned char *out) {
+// Rasterizes the runs of n colors into n masks with a single pass over the
+// runs. A mask pixel covers scale x scale image pixels and is set if any
+// of them has the color. Packed rows have the bit order of numpy.packbits.
+// Untracked colors have no runs, their masks come from the segmented image.
+	const cmv_class *cls = vis->config->classes;
+	int w = vis->width;
+	int mw = (w + scale - 1) / scale;
+	int mh = (vis->height + scale - 1) / scale;
+	size_t stride = packed ? (mw + 7) / 8 : mw;
+	size_t plane = stride * mh;
+	unsigned long long inv = 0xffffffffULL / scale + 1;
+	int plane_of[256], scan_of[256];
+	unsigned char line[MAX_WIDTH];
+	int untracked = 0;
+	int i, x, y;
+
+	memset(out, 0, plane * n);
+	for (i = 0; i < 256; i++) {
+		plane_of[i] = -1;
+	}
+	for (i = n - 1; i >= 0; i--) {
+		if (colors[i] >= 0 && colors[i] < 256) {
+			plane_of[colors[i]] = i;
+		}
+	}
+
+	for (i = 0; i < vis->run_c; i++) {
+		const run *r = &vis->rle[i];
+		int p = plane_of[r->color];
+		// row end runs of untracked colors are skipped too
+		if (p >= 0 && r->width > 0 && cls[r->color].min_area < MAX_INT) {
+			mask_span(out + p * plane + scale_down(r->y, inv) * stride, scale_down(r->x, inv), scale_down(r->x + r->width - 1, inv), packed);
+		}
+	}
+
+	for (i = 0; i < 256; i++) {
+		scan_of[i] = i > CMV_VOID || cls[i].min_area == MAX_INT ? plane_of[i] : -1;
+		if (scan_of[i] >= 0) {
+			untracked = 1;
+		}
+	}
+	for (i = 0; untracked && i < 256; i++) {
+		for (y = 0; scan_of[i] >= 0 && y < vis->height; y++) {
+			unsigned char *dst = out + scan_of[i] * plane + scale_down(y, inv) * stride;
+			if (scale == 1) {
+				mask_row(dst, vis->segmented + y * w, w, i, packed);
+				continue;
+			}
+			// or together the pixels of each scale wide block
+			mask_row(line, vis->segmented + y * w, w, i, 0);
+			for (x = 0; x < mw; x++) {
+				int k, end = min((x + 1) * scale, w);
+				unsigned char set = 0;
+				for (k = x * scale; k < end; k++) {
+					set |= line[k];
+				}
+				if (packed) {
+					dst[x >> 3] |= set << (7 - (x & 7));
+				} else {
+					dst[x] |= set;
+				}
+			}
+		}
+	}
+
+	// a color asked for twice gets the mask of its first plane
+	for (i = 0; i < n; i++) {
+		if (colors[i] >= 0 && colors[i] < 256 && plane_of[colors[i]] != i) {
+			memcpy(out + i * plane, out + plane_of[colors[i]] * plane, plane);
+		}
+	}
+}
+
+static double now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void threshold_decimated(cmv_vision *vis, const unsigned char *f) {
+// Like cmv_threshold without statistics, but only every second row is
+// looked up, the rows in between take the colors of the row above.
+	int w = vis->width;
+	int h = vis->height;
+	int x, y, xy;
+	unsigned char *segmented = vis->segmented;
+	const cmv_config *cfg = vis->config;
+	const unsigned char *lookup = cfg->colors_lookup;
+
+	for (y = 0; y < h; y += 2) {
+		for (xy = y * w, x = 0; x < w; x += 2, xy += 2) {
+			if (cfg->pixel_active[xy]) {
+				segmented[xy] = lookup[f[2*xy] + (f[2*xy+1] << 8) + (f[2*xy+3] << 16)];
+				segmented[xy+1] = lookup[f[2*xy+2] + (f[2*xy+1] << 8) + (f[2*xy+3] << 16)];
+			}
+		}
+		if (y + 1 >= h) break;
+		for (xy = (y + 1) * w, x = 0; x < w; x += 2, xy += 2) {
+			if (cfg->pixel_active[xy]) {
+				segmented[xy] = segmented[xy - w];
+				segmented[xy+1] = segmented[xy + 1 - w];
+			}
+		}
+	}
+}
+
+static void drop_low_priority(cmv_vision *vis) {
+// Removes the runs of low priority colors before they are connected.
+// Row end runs are kept with the untracked CMV_VOID color.
+	run *rle = vis->rle;
+	const cmv_class *cls = vis->config->classes;
+	int num = vis->run_c;
+	int w = vis->width;
+	int i, o = 0;
+	run r;
+
+	for (i = 0; i < num; i++) {
+		r = rle[i];
+		if (cls[r.color].low_priority) {
+			if (r.x + r.width < w) continue;
+			r.color = CMV_VOID;
+		}
+		r.parent = o;
+		rle[o++] = r;
+	}
+	vis->run_c = o;
+}
+
+int cmv_prepare(cmv_vision *vis) {
+// Starts a frame: clears the degradation flags and brings the run,
+// region and incremental buffers in line with the config. Returns 1 if
+// the incremental threshold and encode stages are to be used.
+	const cmv_config *cfg = vis->config;
+	int incremental = cfg->inc_tile > 0 && !cfg->stats;
+
+	vis->degraded = 0;
+	if (vis->rle_cap > cfg->max_runs) {
+		vis->rle_cap = cfg->max_runs;
+		vis->inc_valid = 0;
+	}
+	if (vis->regions_cap > cfg->max_regions) {
+		vis->regions_cap = cfg->max_regions;
+	}
+	if (incremental && (vis->inc_tile != cfg->inc_tile || vis->inc_version != cfg->version)) {
+		if (vis->inc_tile != cfg->inc_tile && alloc_incremental(vis)) {
+			incremental = 0;
+		}
+		vis->inc_valid = 0;
+		vis->inc_version = cfg->version;
+	}
+	return incremental;
+}
+
+void cmv_segment(cmv_vision *vis, const unsigned char *yuyv) {
+// Runs the whole segmentation pipeline on one YUYV frame. Only touches
+// vis, so pipelines sharing a config can run in parallel. With a time
+// budget, a frame which is over it after encoding drops low priority
+// colors and skips morphology, and frames after one over budget are
+// classified on every second row until there is room again.
+	const cmv_config *cfg = vis->config;
+	double start = now_us();
+	int incremental = cmv_prepare(vis);
+	int over;
+
+	if (vis->perf) {
+		cmv_perf_begin(vis->perf);
+	}
+	if (incremental) {
+		cmv_threshold_incremental(vis, yuyv);
+		PERF_STAGE(vis, CMV_STAGE_THRESHOLD);
+		cmv_encode_runs_incremental(vis);
+	} else {
+		if (vis->decimate) {
+			threshold_decimated(vis, yuyv);
+			vis->degraded |= CMV_DEGRADED_DECIMATED;
+		} else {
+			cmv_threshold(vis, yuyv);
+		}
+		PERF_STAGE(vis, CMV_STAGE_THRESHOLD);
+		cmv_encode_runs(vis);
+		vis->inc_valid = 0;
+		vis->dirty_ratio = 1;
+	}
+	PERF_STAGE(vis, CMV_STAGE_ENCODE);
+	over = cfg->budget_us > 0 && now_us() - start > cfg->budget_us;
+	if (over && cfg->low_priority) {
+		drop_low_priority(vis);
+		vis->degraded |= CMV_DEGRADED_LOW_PRIORITY;
+		if (vis->perf) {
+			// not a stage of its own, keep it out of the next one
+			cmv_perf_skip(vis->perf);
+		}
+	}
+	if (cfg->morph) {
+		if (over) {
+			vis->degraded |= CMV_DEGRADED_MORPHOLOGY;
+		} else {
+			cmv_morph_runs(vis);
+			PERF_STAGE(vis, CMV_STAGE_MORPH);
+		}
+	}
+	cmv_connect_components(vis);
+	PERF_STAGE(vis, CMV_STAGE_CONNECT);
+	if (cfg->morph_close_h > 0) {
+		if (over) {
+			vis->degraded |= CMV_DEGRADED_MORPHOLOGY;
+		} else {
+			cmv_close_vertical(vis);
+			PERF_STAGE(vis, CMV_STAGE_CLOSE);
+		}
+	}
+	cmv_extract_regions(vis);
+	PERF_STAGE(vis, CMV_STAGE_EXTRACT);
+	cmv_separate_regions(vis);
+	PERF_STAGE(vis, CMV_STAGE_SEPARATE);
+
+	// do minimal number of passes sufficient to touch all set bits
+	int y = 0;
+	int area = vis->max_area;
+	while( area != 0 ) {
+		area >>= CMV_RBITS;
+		y++;
+	}
+	vis->passes = y;
+
+	if (vis->perf) {
+		// sorting is lazy, do it here so it can be measured
+		for (y = 0; y < COLOR_COUNT; y++) {
+			cmv_sorted_list(vis, y);
+		}
+		PERF_STAGE(vis, CMV_STAGE_SORT);
+	}
+
+	vis->frame_us = now_us() - start;
+	if (cfg->budget_us > 0 && !incremental && !cfg->stats) {
+		// hysteresis, a full frame takes about twice a decimated one
+		if (vis->frame_us > cfg->budget_us) {
+			vis->decimate = 1;
+		} else if (vis->frame_us < cfg->budget_us / 2) {
+			vis->decimate = 0;
+		}
+	} else {
+		vis->decimate = 0;
+	}
+}
@@ -0,0 +1,173 @@
+// libcmvision - color segmentation engine of pyCMVision
+//
+// Plain C, no python. A cmv_config holds everything that is set up
+// once (lookup table, active pixels, per color settings), a cmv_vision
+// holds the buffers of one segmentation pipeline. Several cmv_vision
+// can share one cmv_config as long as it is not changed meanwhile.
+
+#ifndef CMVISION_H
+#define CMVISION_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_WIDTH 1280
+#define MAX_HEIGHT 1024
+#define MAX_INT 2147483647
+#define COLOR_COUNT 10
+#define CMV_VOID COLOR_COUNT //untracked color of row end runs dropped by morphology
+#define CMV_RBITS 6
+#define CMV_RADIX (1 << CMV_RBITS)
+#define CMV_RMASK (CMV_RADIX-1)
+#define MAX_RUNS MAX_WIDTH * MAX_HEIGHT / 4 //default cap of runs per frame
+#define MAX_REG MAX_WIDTH * MAX_HEIGHT / 16 //default cap of regions per frame
+#define CMV_INITIAL_RUNS 8192
+#define CMV_INITIAL_REG 2048
+
+// cmv_vision.degraded flags
+#define CMV_DEGRADED_DECIMATED 1 //only every second row was classified
+#define CMV_DEGRADED_LOW_PRIORITY 2 //runs of low priority colors were dropped
+#define CMV_DEGRADED_MORPHOLOGY 4 //morphology was skipped
+#define CMV_TRUNCATED_RUNS 8 //run cap reached, rows from the first incomplete one on are missing
+#define CMV_TRUNCATED_REGIONS 16 //region cap reached, later regions are missing
+
+typedef struct {
+	short x, y, width;
+	unsigned char color;
+	int parent, next;
+} run;
+
+typedef struct region {
+	int color;
+	int x1, y1, x2, y2;
+	float cen_x, cen_y;
+	int area;
+	int run_start;
+	int iterator_id;
+	struct region* next;
+} region;
+
+typedef struct {
+	int min_area;//MAX_INT=color is not tracked
+	int open_w, close_w;//drop runs narrower than open_w, bridge gaps up to close_w pixels
+	int open_h, close_h;//drop vertically isolated runs, connect across close_h rows
+	unsigned char filter;//any of the region filters below is set
+	int max_area;
+	float min_aspect, max_aspect;//bounding box width / height
+	float min_fill;//area / bounding box area
+	int min_r, max_r;//distance of centroid from location table
+	int min_y, max_y;//centroid row
+	unsigned char low_priority;//dropped first when a frame is over budget
+} cmv_class;
+
+typedef struct {
+	unsigned char colors_lookup[0x1000000];//color_id of every YUV combination, y + (u << 8) + (v << 16)
+	unsigned char pixel_active[MAX_WIDTH * MAX_HEIGHT];//0=ignore in segmentation, 1=use pixel
+	cmv_class classes[COLOR_COUNT + 1];//last one is CMV_VOID
+	unsigned char morph;//any run morphology enabled
+	unsigned char morph_open_h;
+	int morph_close_h;//largest close_h
+	unsigned short *loc_r;//pixel location to distance lookup table, one sample every loc_step pixels
+	unsigned short *loc_phi;//pixel location to angle lookup table, one sample every loc_step pixels
+	int loc_w, loc_h, loc_step;//location table grid dimensions and spacing
+	unsigned char stats, stats_uv;//collect histograms and color counts in threshold pass
+	int inc_tile;//incremental tile size in pixels, 0=classify every frame fully
+	int inc_threshold;//mean absolute difference per byte for a changed tile
+	int max_runs, max_regions;//hard caps of the growable run and region storage
+	int budget_us;//frame time budget in microseconds, 0=unlimited
+	unsigned char low_priority;//any color is low priority
+	unsigned int version;//changed by cmv_config_changed, invalidates incremental caches
+} cmv_config;
+
+typedef struct {
+	region *list;
+	int num;
+	unsigned char sorted;//list is sorted by area, largest first
+} color_class_state;
+
+typedef struct {
+	cmv_config *config;
+	int width, height;
+	unsigned char *segmented;//segmented image buffer 0-9, width * (height + 1) bytes
+	unsigned char segmented_owned;//segmented is freed by cmv_free
+
+	run *rle;//rle_cap runs and a guard entry, grows up to config max_runs
+	int rle_cap;
+	region *regions;//grows up to config max_regions
+	int regions_cap;
+	color_class_state colors[COLOR_COUNT];
+	int row_start[MAX_HEIGHT + 1];//first run of each row, used by morphology
+	int run_c;
+	int region_c;
+	int max_area;
+	int passes;
+
+	unsigned int hist[3][256];//Y, U, V histograms of active pixels
+	unsigned int color_counts[256];//active pixel count of each color_id
+
+	int inc_tile;//tile size the incremental buffers were allocated for
+	unsigned char inc_valid;//previous frame, classification and run cache are usable
+	unsigned int inc_version;//config version of the cached results
+	unsigned char *inc_prev;//YUYV content of tiles when they were last classified
+	unsigned char *inc_dirty;//changed flag of each tile in the last frame
+	int inc_tiles_x, inc_tiles_y;
+	unsigned char inc_row_dirty[MAX_HEIGHT];//tile row has a changed tile
+	run *inc_runs;//runs of the previous frame
+	int inc_runs_cap;
+	int inc_row[MAX_HEIGHT + 1];//first cached run of each row
+	float dirty_ratio;//changed tiles / all tiles in the last frame
+
+	unsigned int degraded;//CMV_DEGRADED_* and CMV_TRUNCATED_* flags of the last frame
+	unsigned char decimate;//classify every second row in the next frame to stay in budget
+	float frame_us;//time of the last cmv_segment
+	struct cmv_perf *perf;//per stage counters of cmv_segment (cmv_perf.h), NULL=off
+} cmv_vision;
+
+// configuration
+void cmv_config_init(cmv_config *cfg);
+void cmv_config_free(cmv_config *cfg);
+void cmv_config_changed(cmv_config *cfg);
+int cmv_set_locations(cmv_config *cfg, const unsigned short *r, const unsigned short *phi, int w, int h, int step);
+void cmv_locate(const cmv_config *cfg, float x, float y, unsigned short *r, unsigned short *phi);
+
+// pipeline state
+void cmv_init(cmv_vision *v, cmv_config *cfg);
+int cmv_set_size(cmv_vision *v, int w, int h);
+void cmv_free(cmv_vision *v);
+void cmv_use_segmented(cmv_vision *v, unsigned char *buf);
+cmv_vision *cmv_create(cmv_config *cfg, int w, int h);
+void cmv_destroy(cmv_vision *v);
+
+// stages, in pipeline order, cmv_prepare starts a frame and tells
+// whether to use the incremental threshold and encode stages
+int cmv_prepare(cmv_vision *v);
+void cmv_threshold(cmv_vision *v, const unsigned char *yuyv);
+void cmv_encode_runs(cmv_vision *v);
+void cmv_threshold_incremental(cmv_vision *v, const unsigned char *yuyv);
+void cmv_encode_runs_incremental(cmv_vision *v);
+void cmv_morph_runs(cmv_vision *v);
+void cmv_connect_components(cmv_vision *v);
+void cmv_close_vertical(cmv_vision *v);
+void cmv_extract_regions(cmv_vision *v);
+void cmv_separate_regions(cmv_vision *v);
+region *cmv_sort_regions(region *list, int passes);
+
+// whole pipeline on one YUYV frame
+void cmv_segment(cmv_vision *v, const unsigned char *yuyv);
+
+// results
+region *cmv_sorted_list(cmv_vision *v, int color);
+int cmv_fill_blobs(cmv_vision *v, int color, unsigned short *out, int max_rows);
+
+// n masks of ceil(height/scale) rows of ceil(width/scale) pixels, a row
+// is (pixels+7)/8 bytes when packed (MSB first) or pixels bytes of 0/1
+void cmv_class_masks(const cmv_vision *v, const int *colors, int n, int scale, int packed, unsigned char *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -29,25 +29,18 @@ cam.setColorMinArea(1, 10)#find blobs having color 1 with min area 30
 cam.set(sharpness=6)
 ###
 cam.start()# Start recording
-segmented_buffer = cam.getBuffer()#get buffer containing thresholded image
 
 cv2.namedWindow('tava')
 print("Press 'q' to quit")
 while True:
 	cam.analyse()
 	blobs = cam.getBlobs(1)
-	img = np.copy(segmented_buffer)*127
 	if len(blobs) > 0:
 		ball = blobs[0]
 		print('Largest ball d={r: >5}mm, fii={f: >3}deg, area={a: >5}px, x={x: >4}, y={y: >4}'.format(r=ball[0], f=int(round(ball[1]*360.0/65536.0)), a=ball[2], x=ball[3], y=ball[4]))
 		#print("Obj 1", blobs[0,0], blobs[0,1])
-		#draw white bounding box
-		img[blobs[0,7]:blobs[0,8],blobs[0,5]:blobs[0,5]+2] = 255#left line
-		img[blobs[0,7]:blobs[0,8],blobs[0,6]:blobs[0,6]+2] = 255#right line
-		img[blobs[0,7]:blobs[0,7]+2,blobs[0,5]:blobs[0,6]] = 255#top line
-		img[blobs[0,8]:blobs[0,8]+2,blobs[0,5]:blobs[0,6]] = 255#bottom line
 	
-	cv2.imshow('tava', img[::2,::2])#show segmentated image and bounding box
+	cv2.imshow('tava', cam.renderPreview(2))#show half size segmentated image and bounding boxes
 
 	if cv2.waitKey(1) & 0xff == ord('q'):#exit
 		break
@@ -1,53 +1,40 @@
 // python v4l2 functions taken from python-v4l2capture module
 // (https://github.com/gebart/python-v4l2capture)
 
-#define USE_LIBV4L
-
 #include <Python.h>
 
 #include <sys/ioctl.h>
-#include <fcntl.h>
-#include <linux/videodev2.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <time.h>
 #define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
 #include "numpy/arrayobject.h"
-#ifdef USE_LIBV4L
-#include <libv4l2.h>
-#else
-#include <sys/ioctl.h>
-#define v4l2_close close
-#define v4l2_ioctl ioctl
-#define v4l2_mmap mmap
-#define v4l2_munmap munmap
-#define v4l2_open open
-#endif
+
+#include "cmvision.h"
+#include "cmv_capture.h"
+#include "cmv_perf.h"
 
 #ifndef Py_TYPE
 	#define Py_TYPE(ob) (((PyObject*)(ob))->ob_type)
 #endif
 
 
-#define ASSERT_OPEN if(self->fd < 0) { \
+#define ASSERT_OPEN if(self->cap.fd < 0) { \
 	PyErr_SetString(PyExc_ValueError, "I/O operation on closed file"); \
 	return NULL; \
 }
 
-#define CLEAR(x) memset(&(x), 0, sizeof(x))
-
-struct buffer {
-	void *start;
-	size_t length;
-};
+#define ASSERT_IDLE if(self->streaming || self->pending) { \
+	PyErr_SetString(PyExc_RuntimeError, self->streaming ? "Camera is streaming" : "Camera is busy"); \
+	return NULL; \
+}
 
-#define MAX_WIDTH 1280
-#define MAX_HEIGHT 1024
-#define MAX_INT 2147483647
-#define COLOR_COUNT 10
-#define CMV_RBITS 6
-#define CMV_RADIX (1 << CMV_RBITS)
-#define CMV_RMASK (CMV_RADIX-1)
-#define MAX_RUNS MAX_WIDTH * MAX_HEIGHT / 4
-#define MAX_REG MAX_WIDTH * MAX_HEIGHT / 16
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
 
 #define max(a,b) \
 	({ __typeof__ (a) _a = (a); \
@@ -59,31 +46,125 @@ struct buffer {
 		__typeof__ (b) _b = (b); \
 		_a < _b ? _a : _b; })
 
+#define MAX_TRACKS 64
+#define MAX_CTRLS 256
+#define CTRL_HASH 512 //power of 2 > MAX_CTRLS
+#define TRACK_SMOOTHING 0.5f //weight of new velocity measurement
+
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof(arr[0]))
 
+#pragma pack(push, 1)
 typedef struct {
-	short x, y, width;
+	unsigned short x, y, width;
 	unsigned char color;
-	int parent, next;
-} run;
+	int region;
+} run_record;//exported run, layout of run_descr
+#pragma pack(pop)
 
-typedef struct region {
-	int color;
-	int x1, y1, x2, y2;
+static PyArray_Descr *run_descr = NULL;
+
+#pragma pack(push, 1)
+typedef struct {
+	unsigned int id;
+	unsigned char color;
+	float x, y, vx, vy;
+	float r, phi, vr, vphi;
+	int area;
+	unsigned short x1, x2, y1, y2;
+	unsigned short age, missed;
+} track_record;//exported track, layout of track_descr
+#pragma pack(pop)
+
+static PyArray_Descr *track_descr = NULL;
+
+#pragma pack(push, 1)
+typedef struct {
+	unsigned short ray, index;//path and position along it
+	unsigned short x, y;
+	unsigned char from, to;//color ids before and at the position
+	unsigned short r;//distance from location table
+} transition_record;//scanline color change, layout of transition_descr
+#pragma pack(pop)
+
+static PyArray_Descr *transition_descr = NULL;
+
+#pragma pack(push, 1)
+typedef struct {
+	unsigned int frame;//index of the frame in the batch
+	unsigned char color;
+	unsigned short distance, angle;
+	int area;
 	float cen_x, cen_y;
+	unsigned short x1, x2, y1, y2;
+} blob_record;//blob of analyseBatch(), layout of blob_descr
+#pragma pack(pop)
+
+static PyArray_Descr *blob_descr = NULL;
+
+#define BATCH_CHUNK 8 //consecutive frames a worker takes at once
+
+typedef struct {
+	unsigned int id;
+	float x, y;//centroid
+	float vx, vy;//pixels per second
+	float r, phi;//polar location
+	float vr, vphi;//polar units per second
+	int x1, y1, x2, y2;
 	int area;
-	int run_start;
-	int iterator_id;
-	struct region* next;
-} region;
+	int hits, missed, age;
+	unsigned char confirmed;
+} track;
 
 typedef struct {
-	region *list;
+	float gate;//max distance from predicted centroid in pixels, 0=disabled
+	int confirm;//hits before track is reported
+	int max_missed;//missed frames before confirmed track is dropped
 	int num;
-	int min_area;
-	unsigned char color;
-	char *name;
-} color_class_state;
+	track tracks[MAX_TRACKS];
+} color_tracker;
+
+typedef struct {
+	float cost;
+	int track;
+	region *reg;
+} track_pair;
+
+#define SHM_MAGIC 0x53564d43 //"CMVS"
+#define SHM_VERSION 1
+#define SHM_ALIGN(x) (((x) + 63) & ~(size_t)63)
+#define SHM_HEADER_SIZE SHM_ALIGN(sizeof(shm_header))
+#define SHM_READ_TRIES 1000 //attempts of Subscriber.read() to find a slot not being written
+
+typedef struct {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int slot_count;
+	unsigned int slot_size;//bytes per slot
+	unsigned int segmented_offset;//segmented image offset in slot
+	unsigned int color_n;
+	unsigned int max_blobs;//blob rows per color in slot
+	unsigned int width, height;
+	unsigned int has_segmented;
+	unsigned int colors[COLOR_COUNT];
+	unsigned long long latest;//published frames, latest is in slot (latest-1) % slot_count
+} shm_header;
+
+typedef struct {
+	unsigned int gen;//odd while publisher writes the slot
+	unsigned int seq;
+	unsigned long long time;
+	unsigned int counts[COLOR_COUNT];
+	// followed by blobs [color_n][max_blobs][9] and segmented image at segmented_offset
+} shm_slot;
+
+#define OUTPUT_SLOTS 3
+#define OUTPUT_CAPSULE "pyCMVision.output"
+
+typedef struct {
+	PyObject *slots[OUTPUT_SLOTS];//capsules owning the buffers, arrays returned to python hold a reference
+	int current;//slot of the latest result
+	size_t size;
+} output_ring;
 
 typedef struct {
 	char* keyword;
@@ -92,219 +173,242 @@ typedef struct {
 
 typedef struct {
 	PyObject_HEAD
-	int fd;
-	struct buffer *buffers;
-	int buffer_count;
-	unsigned char colors_lookup[0x1000000];//all possible bgr combinations lookup table
-	unsigned short loc_r[MAX_WIDTH * MAX_HEIGHT];//pixel location to distance lookup table
-	unsigned short loc_phi[MAX_WIDTH * MAX_HEIGHT];//pixel location to angle lookup table
-	unsigned char pixel_active[MAX_WIDTH * MAX_HEIGHT];//0=ignore in segmentation, 1=use pixel
-	unsigned char *segmented;//segmented image buffer 0-9
-	unsigned char *img;//Image buffer
+	cmv_capture cap;
+	cmv_config cfg;
+	cmv_vision vis;
+	cmv_perf perf;//stage counters of setProfiling(), vis.perf points here when enabled
+	output_ring seg_out;//segmented image, the engine writes into the current slot
+	output_ring img_out;//image() result
+	output_ring preview_out;//renderPreview() result
+	output_ring mask_out;//getMask() and getMasks() result
 	unsigned short *pout;//Temp out buffer (for blobs)
-	int width, height, bpp;
-	unsigned char started;
+	unsigned char *preview;//current preview_out buffer
+	int preview_w, preview_h;
+	unsigned char palette[256][3];//bgr color of each color_id in preview
+	int bpp;
+	unsigned char streaming;//capture thread of stream() owns the pipeline
+	unsigned char pending;//frame is being captured or analysed without the GIL
+	struct async_job *async;//analyse_async() job waiting for or analysing a frame
+
+	Py_buffer *pool;//caller buffers frames are captured into, see usePool()
+	int pool_n;
+	struct v4l2_buffer held;//pool buffer of the last analysed frame
+	unsigned char holding;
 
 	int ctrls_n;
-	struct v4l2_queryctrl ctrls[256];
-	
-	run rle[MAX_RUNS];
-	region regions[MAX_REG];
-	color_class_state colors[COLOR_COUNT];
-	int run_c;
-	int region_c;
-	int max_area;
-	int passes;
+	struct v4l2_queryctrl ctrls[MAX_CTRLS];
+	char ctrl_names[MAX_CTRLS][32];//python names of ctrls
+	short ctrl_hash[CTRL_HASH];//index+1 of the ctrl with that name hash, 0=empty
+
+	double ae_target;//auto exposure target mean luma, 0=disabled
+	double ae_gain, ae_deadband;
+	int ae_id, ae_min, ae_max, ae_value;//exposure control id, range and current value
+	unsigned char stats_on;//statistics enabled with setStatistics, auto exposure adds its own
+
+	color_tracker trackers[COLOR_COUNT];
+	unsigned int track_id;//last assigned track id
+	unsigned long long track_time;//timestamp of last tracked frame, ~0 before first frame
+	track_pair *pairs;//association candidates
+	int pairs_cap;
+
+	int *scan_pix;//pixel indices of all scanline paths, NULL if not set
+	int *scan_start;//first pixel of each path, scan_n+1 entries
+	int scan_n;
+	int scan_w, scan_h;//resolution the paths were made for
+	transition_record *scan_out;
+
+	void *shm;//shared memory of publish(), NULL if not publishing
+	size_t shm_size;
+	char *shm_name;
 } Camera;
 
-static int my_ioctl(int fd, int request, void *arg) {
-	// Retry ioctl until it returns without being interrupted.
-	for(;;) {
-		int result = v4l2_ioctl(fd, request, arg);
-		if(!result) {
-			return 0;
-		}
-		if(errno != EINTR) {
-			PyErr_SetFromErrno(PyExc_IOError);
-			return 1;
-		}
-	}
+static void Output_destroy(PyObject *capsule) {
+	free(PyCapsule_GetPointer(capsule, OUTPUT_CAPSULE));
 }
 
-static void Camera_unmap(Camera *self) {
-	int i;
+static unsigned char *Output_next(output_ring *ring, size_t size) {
+// Returns the buffer the next result is written to. The current buffer is
+// reused while no array of it is alive, otherwise the next free slot, so
+// arrays of earlier frames never change. If every slot is still in use
+// the oldest is left to its arrays and replaced. Needs the GIL.
+	PyObject *current = ring->slots[ring->current];
+	int i, n;
 
-	for(i = 0; i < self->buffer_count; i++) {
-		v4l2_munmap(self->buffers[i].start, self->buffers[i].length);
+	if (current != NULL && ring->size == size && Py_REFCNT(current) == 1) {
+		return (unsigned char *)PyCapsule_GetPointer(current, OUTPUT_CAPSULE);
 	}
-}
-
-static void Camera_dealloc(Camera *self) {
-	if(self->fd >= 0) {
-		if(self->buffers) {
-			Camera_unmap(self);
+	if (ring->size != size) {
+		for (i = 0; i < OUTPUT_SLOTS; i++) {
+			Py_CLEAR(ring->slots[i]);
 		}
-
-		v4l2_close(self->fd);
+		ring->size = size;
 	}
-	if (self->segmented != NULL) {
-		free(self->segmented);
+	for (n = 1; n <= OUTPUT_SLOTS; n++) {
+		i = (ring->current + n) % OUTPUT_SLOTS;
+		if (ring->slots[i] == NULL || Py_REFCNT(ring->slots[i]) == 1) {
+			break;
+		}
 	}
-	if (self->img != NULL) {
-		free(self->img);
+	if (n > OUTPUT_SLOTS) {
+		i = (ring->current + 1) % OUTPUT_SLOTS;
+		Py_CLEAR(ring->slots[i]);
 	}
-	if (self->pout != NULL) {
-		free(self->pout);
+	if (ring->slots[i] == NULL) {
+		void *data = calloc(size, 1);
+		if (data == NULL) {
+			PyErr_NoMemory();
+			return NULL;
+		}
+		ring->slots[i] = PyCapsule_New(data, OUTPUT_CAPSULE, Output_destroy);
+		if (ring->slots[i] == NULL) {
+			free(data);
+			return NULL;
+		}
 	}
-
-	Py_TYPE(self)->tp_free((PyObject *)self);
+	ring->current = i;
+	return (unsigned char *)PyCapsule_GetPointer(ring->slots[i], OUTPUT_CAPSULE);
 }
 
-static int Camera_set_resolution(Camera *self, int w, int h) {
-	struct v4l2_format format;
-	CLEAR(format);
-	format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	/* Get the current format */
-	if(my_ioctl(self->fd, VIDIOC_G_FMT, &format)) {
-		return -1;
+static PyObject *Output_view(output_ring *ring, int nd, npy_intp *dims, int type) {
+	//array of the current buffer, keeps the buffer alive
+	PyObject *capsule = ring->slots[ring->current];
+	PyArrayObject *outArray = (PyArrayObject *) PyArray_SimpleNewFromData(nd, dims, type,
+		PyCapsule_GetPointer(capsule, OUTPUT_CAPSULE));
+	if (outArray == NULL) {
+		return NULL;
 	}
-
-	format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
-	format.fmt.pix.field = V4L2_FIELD_INTERLACED;
-	format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	format.fmt.pix.width = w;
-	format.fmt.pix.height = h;
-	format.fmt.pix.bytesperline = 0;
-
-	if(my_ioctl(self->fd, VIDIOC_S_FMT, &format)) {
-		return -1;
+	Py_INCREF(capsule);
+	if (PyArray_SetBaseObject(outArray, capsule)) {
+		Py_DECREF(outArray);
+		return NULL;
 	}
+	return PyArray_Return(outArray);
+}
 
-	self->width = (int)w;
-	self->height = (int)h;
-	
-	int size = self->width * self->width;
-	
-	if (self->segmented != NULL) {
-		free(self->segmented);
-	}
-	self->segmented = (unsigned char *)calloc(size, sizeof(unsigned char));
-	
-	if (self->img != NULL) {
-		free(self->img);
+static void Output_free(output_ring *ring) {
+	int i;
+	for (i = 0; i < OUTPUT_SLOTS; i++) {
+		Py_CLEAR(ring->slots[i]);
 	}
-	self->img = (unsigned char *)malloc(size * sizeof(unsigned char) * 3);
-	return 0;
 }
 
-static int Camera_set_fps(Camera *self, int fps) {
-	struct v4l2_streamparm setfps;
-	CLEAR(setfps);
-	setfps.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	setfps.parm.capture.timeperframe.numerator = 1;
-	setfps.parm.capture.timeperframe.denominator = fps;
-	if(my_ioctl(self->fd, VIDIOC_S_PARM, &setfps)){
+static int Camera_next_segmented(Camera *self) {
+	//let the engine write the next frame to a segmented slot no array uses, -1 with exception set
+	unsigned char *buf = Output_next(&self->seg_out, (size_t)self->vis.width * (self->vis.height + 1));
+	if (buf == NULL) {
 		return -1;
 	}
+	cmv_use_segmented(&self->vis, buf);
 	return 0;
 }
 
-static int Camera_create_buffers(Camera *self, int buffer_count) {
-
-	if(self->fd < 0) {
-		return -1;
+static void Camera_free_pool(Camera *self) {
+	//release the caller buffers, the capture must not use them anymore
+	int i;
+	for (i = 0; i < self->pool_n; i++) {
+		PyBuffer_Release(&self->pool[i]);
 	}
+	free(self->pool);
+	self->pool = NULL;
+	self->pool_n = 0;
+	self->holding = 0;
+}
 
-	if(self->buffers) {
-		//PyErr_SetString(PyExc_ValueError, "Buffers are already created");
-		return -1;
+static void Camera_dealloc(Camera *self) {
+	cmv_capture_close(&self->cap);
+	Camera_free_pool(self);
+	cmv_perf_close(&self->perf);
+	cmv_free(&self->vis);
+	cmv_config_free(&self->cfg);
+	Output_free(&self->seg_out);
+	Output_free(&self->img_out);
+	Output_free(&self->preview_out);
+	Output_free(&self->mask_out);
+	if (self->pout != NULL) {
+		free(self->pout);
 	}
-
-	struct v4l2_requestbuffers reqbuf;
-	reqbuf.count = buffer_count;
-	reqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	reqbuf.memory = V4L2_MEMORY_MMAP;
-
-	if(my_ioctl(self->fd, VIDIOC_REQBUFS, &reqbuf)) {
-		return -1;
+	if (self->pairs != NULL) {
+		free(self->pairs);
 	}
-
-	if(!reqbuf.count) {
-		//PyErr_SetString(PyExc_IOError, "Not enough buffer memory");
-		return -1;
+	if (self->scan_pix != NULL) {
+		free(self->scan_pix);
+		free(self->scan_start);
+		free(self->scan_out);
 	}
-
-	self->buffers = malloc(reqbuf.count * sizeof(struct buffer));
-
-	if(!self->buffers) {
-		//PyErr_NoMemory();
-		return -1;
+	if (self->shm != NULL) {
+		munmap(self->shm, self->shm_size);
+		shm_unlink(self->shm_name);
+	}
+	if (self->shm_name != NULL) {
+		free(self->shm_name);
 	}
 
-	int i;
-
-	for(i = 0; i < reqbuf.count; i++) {
-		struct v4l2_buffer buffer;
-		buffer.index = i;
-		buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buffer.memory = V4L2_MEMORY_MMAP;
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
 
-		if(my_ioctl(self->fd, VIDIOC_QUERYBUF, &buffer)) {
-			return -1;
-		}
+static char* name2var(unsigned char *name) {
+	int add_underscore = 0;
+	int i = 0;
 
-		self->buffers[i].length = buffer.length;
-		self->buffers[i].start = v4l2_mmap(NULL, buffer.length,
-			PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, buffer.m.offset);
+	static char s[128];
 
-		if(self->buffers[i].start == MAP_FAILED) {
-			//PyErr_SetFromErrno(PyExc_IOError);
-			return -1;
+	while (*name) {
+		if (isalnum(*name)) {
+			if (add_underscore) s[i++] = '_';
+			add_underscore = 0;
+			s[i++] = tolower(*name);
 		}
+		else if (ARRAY_SIZE(s)) add_underscore = 1;
+		name++;
 	}
-
-	self->buffer_count = i;
-	//Py_RETURN_NONE;
-	return 0;
+	s[i] = '\0';
+	return s;
 }
 
-static int Camera_queue_all_buffers(Camera *self) {
-	if(!self->buffers) {
-		//ASSERT_OPEN;
-		//PyErr_SetString(PyExc_ValueError, "Buffers have not been created");
-		return -1;
+static unsigned int ctrl_hash(const char *name) {
+	//FNV-1a
+	unsigned int h = 2166136261u;
+	while (*name) {
+		h = (h ^ (unsigned char)*name++) * 16777619u;
 	}
+	return h;
+}
 
-	int i;
-	int buffer_count = self->buffer_count;
-
-	for(i = 0; i < buffer_count; i++) {
-		struct v4l2_buffer buffer;
-		buffer.index = i;
-		buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buffer.memory = V4L2_MEMORY_MMAP;
-
-		if(my_ioctl(self->fd, VIDIOC_QBUF, &buffer)) {
-			return -1;
+static int Camera_find_ctrl(Camera *self, const char *name) {
+	//index of the named control or -1
+	unsigned int h = ctrl_hash(name) & (CTRL_HASH - 1);
+	while (self->ctrl_hash[h]) {
+		int i = self->ctrl_hash[h] - 1;
+		if (strcmp(name, self->ctrl_names[i]) == 0) {
+			return i;
 		}
+		h = (h + 1) & (CTRL_HASH - 1);
 	}
-
-	return 0;
+	return -1;
 }
 
 static int Camera_init_ctrls(Camera *self) {
 	struct v4l2_queryctrl queryctrl;
+	self->ctrls_n = 0;
+	memset(self->ctrl_hash, 0, sizeof(self->ctrl_hash));
 	memset(&queryctrl, 0, sizeof(queryctrl));
 	queryctrl.id = V4L2_CTRL_CLASS_USER | V4L2_CTRL_FLAG_NEXT_CTRL;
-	while (0 == ioctl(self->fd, VIDIOC_QUERYCTRL, &queryctrl)) {
-		if (queryctrl.flags & V4L2_CTRL_FLAG_DISABLED)
-			continue;
-
-		self->ctrls[self->ctrls_n++] = queryctrl;
+	while (self->ctrls_n < MAX_CTRLS && 0 == ioctl(self->cap.fd, VIDIOC_QUERYCTRL, &queryctrl)) {
+		int i = self->ctrls_n;
+		//a cut name could collide with another control, skip controls whose name does not fit
+		if (!(queryctrl.flags & V4L2_CTRL_FLAG_DISABLED)
+				&& snprintf(self->ctrl_names[i], sizeof(self->ctrl_names[i]), "%s", name2var(queryctrl.name)) < (int)sizeof(self->ctrl_names[i])
+				&& Camera_find_ctrl(self, self->ctrl_names[i]) < 0) {
+			unsigned int h;
+			self->ctrls_n++;
+			self->ctrls[i] = queryctrl;
+			for (h = ctrl_hash(self->ctrl_names[i]) & (CTRL_HASH - 1); self->ctrl_hash[h]; h = (h + 1) & (CTRL_HASH - 1));
+			self->ctrl_hash[h] = i + 1;
+		}
 
 		queryctrl.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
 	}
-	if (errno != EINVAL) {
+	if (self->ctrls_n < MAX_CTRLS && errno != EINVAL) {
 		return -1;
 	}
 
@@ -313,24 +417,19 @@ static int Camera_init_ctrls(Camera *self) {
 
 static PyObject *Camera_start(Camera *self) {
 	ASSERT_OPEN;
-	enum v4l2_buf_type type;
-	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-
-	if(my_ioctl(self->fd, VIDIOC_STREAMON, &type)) {
-		return NULL;
+	ASSERT_IDLE;
+	if(cmv_capture_start(&self->cap)) {
+		return PyErr_SetFromErrno(PyExc_IOError);
 	}
-	self->started = 1;
 
 	Py_RETURN_NONE;
 }
 
 static PyObject *Camera_stop(Camera *self) {
 	ASSERT_OPEN;
-	enum v4l2_buf_type type;
-	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-
-	if(my_ioctl(self->fd, VIDIOC_STREAMOFF, &type)) {
-		return NULL;
+	ASSERT_IDLE;
+	if(cmv_capture_stop(&self->cap)) {
+		return PyErr_SetFromErrno(PyExc_IOError);
 	}
 
 	Py_RETURN_NONE;
@@ -356,79 +455,103 @@ static int Camera_init(Camera *self, PyObject *args, PyObject *kwargs) {
 		return -1;
 	}
 
-	int fd = v4l2_open(device_path, O_RDWR | O_NONBLOCK);
-
-	if(fd < 0) {
-		PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)device_path);
-		return -1;
-	}
-
-	self->fd = fd;
-	self->buffers = NULL;
-
-	self->started = 0;
+	cmv_capture_init(&self->cap);
+	cmv_config_init(&self->cfg);
+	cmv_init(&self->vis, &self->cfg);
+	cmv_perf_init(&self->perf);
+	self->streaming = 0;
+	self->pending = 0;
+	self->async = NULL;
+	self->pool = NULL;
+	self->pool_n = 0;
+	self->holding = 0;
 	self->bpp = 1;
-	self->width = 0;
-	self->height = 0;
-	self->segmented = NULL;
-	self->img = NULL;
+	memset(&self->seg_out, 0, sizeof(self->seg_out));
+	memset(&self->img_out, 0, sizeof(self->img_out));
+	memset(&self->preview_out, 0, sizeof(self->preview_out));
+	memset(&self->mask_out, 0, sizeof(self->mask_out));
 	self->pout = (unsigned short *) malloc(10000 * 9 * sizeof(unsigned short));
-	self->run_c = 0;
-	self->region_c = 0;
-	self->max_area = 0;
+	self->preview = NULL;
+	self->preview_w = 0;
+	self->preview_h = 0;
+	self->ae_target = 0;
+	self->stats_on = 0;
+	self->track_id = 0;
+	self->track_time = ~0ULL;
+	self->pairs = NULL;
+	self->pairs_cap = 0;
+	self->shm = NULL;
+	self->shm_name = NULL;
+	self->scan_pix = NULL;
+	self->scan_start = NULL;
+	self->scan_out = NULL;
+	self->scan_n = 0;
 	
 	int i;
-	for(i=0; i<COLOR_COUNT; i++) {
-		self->colors[i].list = NULL;
-		self->colors[i].num	= 0;
-		self->colors[i].min_area = MAX_INT;
-		self->colors[i].color = i;
+	static const unsigned char palette[8][3] = {
+		{0, 0, 0}, {0, 0, 255}, {0, 255, 255}, {255, 0, 0},
+		{0, 255, 0}, {255, 255, 255}, {255, 255, 0}, {255, 0, 255}
+	};
+	for (i=0; i<256; i++) {
+		memset(self->palette[i], 127, 3);
 	}
-	
-	for (i=0; i<MAX_WIDTH * MAX_HEIGHT; i++) {
-		self->pixel_active[i] = 1;
+	memcpy(self->palette, palette, sizeof(palette));
+	for(i=0; i<COLOR_COUNT; i++) {
+		self->trackers[i].gate = 0;
+		self->trackers[i].num = 0;
 	}
 
-	Camera_set_resolution(self, w, h);
-	Camera_set_fps(self, fps);
-	Camera_create_buffers(self, 3);
-	Camera_queue_all_buffers(self);
-	Camera_init_ctrls(self);
+	if (cmv_capture_open(&self->cap, device_path, w, h, fps, 3)) {
+		if (errno == EBADMSG) {
+			PyErr_Format(PyExc_IOError, "%s is not a YUYV recording", device_path);
+		} else {
+			PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)device_path);
+		}
+		return -1;
+	}
+	if (cmv_set_size(&self->vis, self->cap.width, self->cap.height)) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	if (Camera_next_segmented(self)) {
+		return -1;
+	}
+	if (!self->cap.replay) {
+		Camera_init_ctrls(self);
+	}
 
 	if (start) {
-		Camera_start(self);
+		cmv_capture_start(&self->cap);
 	}
 
 	return 0;
 }
 
-static char* name2var(unsigned char *name) {
-	int add_underscore = 0;
-	int i = 0;
-
-	static char s[128];
-
-	while (*name) {
-		if (isalnum(*name)) {
-			if (add_underscore) s[i++] = '_';
-			add_underscore = 0;
-			s[i++] = tolower(*name);
-		}
-		else if (ARRAY_SIZE(s)) add_underscore = 1;
-		name++;
+static PyObject *Camera_ctrl_error(Camera *self, const int *idx, int n, int failed) {
+	//raises IOError naming the control that failed
+	if (failed < n) {
+		return PyErr_Format(PyExc_IOError, "%s: %s", self->ctrl_names[idx[failed]], strerror(errno));
 	}
-	s[i] = '\0';
-	return s;
+	return PyErr_SetFromErrno(PyExc_IOError);
 }
 
-static int Camera_get_V4L2_CID(Camera *self, int id) {
-	struct v4l2_control ctrl;
-	CLEAR(ctrl);
-	ctrl.id		= id;
-	if(my_ioctl(self->fd, VIDIOC_G_CTRL, &ctrl)){
+static int Camera_ctrl_index(Camera *self, PyObject *name) {
+	//index of the control named by a python str, -1 with exception set if unknown
+	const char *s = NULL;
+#if PY_MAJOR_VERSION >= 3
+	if (PyUnicode_Check(name)) s = PyUnicode_AsUTF8(name);
+#else
+	if (PyString_Check(name)) s = PyString_AsString(name);
+#endif
+	if (s == NULL) {
+		if (!PyErr_Occurred()) PyErr_SetString(PyExc_TypeError, "Control names must be str");
 		return -1;
 	}
-	return ctrl.value;
+	int i = Camera_find_ctrl(self, s);
+	if (i < 0) {
+		PyErr_Format(PyExc_ValueError, "Unknown control %s", s);
+	}
+	return i;
 }
 
 static PyObject *Camera_get_ctrl(Camera *self, PyObject *args) {
@@ -436,25 +559,17 @@ static PyObject *Camera_get_ctrl(Camera *self, PyObject *args) {
 	if (!PyArg_ParseTuple(args, "s", &param)) {
 		return NULL;
 	}
+	ASSERT_OPEN;
 
-	int i;
-	int retval = -1;
-	for (i=0; i<self->ctrls_n; i++) {
-		if (strcmp(param, name2var(self->ctrls[i].name)) == 0) {
-			retval = Camera_get_V4L2_CID(self, self->ctrls[i].id);
-			break;
-		}
+	int i = Camera_find_ctrl(self, param);
+	if (i < 0) {
+		return PyErr_Format(PyExc_ValueError, "Unknown control %s", param);
 	}
-	
-	return Py_BuildValue("i", retval);
-}
-
-static void Camera_set_V4L2_CID(Camera *self, int id, int value) {
-	struct v4l2_control ctrl;
-	CLEAR(ctrl);
-	ctrl.id		= id;
-	ctrl.value	= value;
-	my_ioctl(self->fd, VIDIOC_S_CTRL, &ctrl);
+	int value;
+	if (cmv_capture_get_ctrl(&self->cap, self->ctrls[i].id, &value)) {
+		return Camera_ctrl_error(self, &i, 1, 0);
+	}
+	return Py_BuildValue("i", value);
 }
 
 static PyObject *Camera_set_ctrl(Camera *self, PyObject *args) {
@@ -463,85 +578,370 @@ static PyObject *Camera_set_ctrl(Camera *self, PyObject *args) {
 	if (!PyArg_ParseTuple(args, "si", &param, &val)) {
 		return NULL;
 	}
+	ASSERT_OPEN;
 
-	int i;
-	for (i=0; i<self->ctrls_n; i++) {
-		if (strcmp(param, name2var(self->ctrls[i].name)) == 0) {
-			Camera_set_V4L2_CID(self, self->ctrls[i].id, val);
-			break;
+	int i = Camera_find_ctrl(self, param);
+	if (i < 0) {
+		return PyErr_Format(PyExc_ValueError, "Unknown control %s", param);
+	}
+	if (cmv_capture_set_ctrl(&self->cap, self->ctrls[i].id, val)) {
+		return Camera_ctrl_error(self, &i, 1, 0);
+	}
+	return Py_BuildValue("I", cmv_capture_settled_seq(&self->cap));
+}
+
+static PyObject *Camera_set_ctrls(Camera *self, PyObject *args) {
+// Sets all controls of a {name: value} dict with one ioctl and returns
+// the sequence number of the first frame captured with the new values.
+	PyObject *dict, *key, *item;
+	Py_ssize_t pos = 0;
+	int idx[MAX_CTRLS], ids[MAX_CTRLS], values[MAX_CTRLS];
+	int n = 0, failed;
+
+	if (!PyArg_ParseTuple(args, "O!", &PyDict_Type, &dict)) {
+		return NULL;
+	}
+	ASSERT_OPEN;
+	if (PyDict_Size(dict) > MAX_CTRLS) {
+		return PyErr_Format(PyExc_ValueError, "At most %d controls", MAX_CTRLS);
+	}
+	while (PyDict_Next(dict, &pos, &key, &item)) {
+		int i = Camera_ctrl_index(self, key);
+		if (i < 0) {
+			return NULL;
+		}
+		long value = PyLong_AsLong(item);
+		if (value == -1 && PyErr_Occurred()) {
+			return NULL;
+		}
+		idx[n] = i;
+		ids[n] = self->ctrls[i].id;
+		values[n++] = (int)value;
+	}
+	if (cmv_capture_set_ctrls(&self->cap, ids, values, n, &failed)) {
+		return Camera_ctrl_error(self, idx, n, failed);
+	}
+	return Py_BuildValue("I", cmv_capture_settled_seq(&self->cap));
+}
+
+static PyObject *Camera_get_ctrls(Camera *self, PyObject *args) {
+	PyObject *names, *seq;
+	int idx[MAX_CTRLS], ids[MAX_CTRLS], values[MAX_CTRLS];
+	int n, i, failed;
+
+	if (!PyArg_ParseTuple(args, "O", &names)) {
+		return NULL;
+	}
+	ASSERT_OPEN;
+	seq = PySequence_Fast(names, "Expected a sequence of control names");
+	if (seq == NULL) {
+		return NULL;
+	}
+	n = PySequence_Fast_GET_SIZE(seq);
+	if (n > MAX_CTRLS) {
+		Py_DECREF(seq);
+		return PyErr_Format(PyExc_ValueError, "At most %d controls", MAX_CTRLS);
+	}
+	for (i = 0; i < n; i++) {
+		idx[i] = Camera_ctrl_index(self, PySequence_Fast_GET_ITEM(seq, i));
+		if (idx[i] < 0) {
+			Py_DECREF(seq);
+			return NULL;
 		}
+		ids[i] = self->ctrls[idx[i]].id;
+	}
+	Py_DECREF(seq);
+	if (cmv_capture_get_ctrls(&self->cap, ids, values, n, &failed)) {
+		return Camera_ctrl_error(self, idx, n, failed);
 	}
 
-	Py_RETURN_NONE;
+	PyObject *dict = PyDict_New();
+	for (i = 0; dict != NULL && i < n; i++) {
+		PyObject *value = Py_BuildValue("i", values[i]);
+		if (value == NULL || PyDict_SetItemString(dict, self->ctrl_names[idx[i]], value)) {
+			Py_XDECREF(value);
+			Py_CLEAR(dict);
+			break;
+		}
+		Py_DECREF(value);
+	}
+	return dict;
 }
 
 static PyObject *Camera_query_ctrls(Camera *self, PyObject *args) {
-	PyObject *glst = PyList_New(self->ctrls_n);
-	int i;
+	int ids[MAX_CTRLS], values[MAX_CTRLS];
+	int i, n = 0, failed;
+
+	//buttons and class headings have no value
 	for (i = 0; i < self->ctrls_n; i++) {
-		PyList_SET_ITEM(glst, i, Py_BuildValue("{sisssisisisisi}", "id", self->ctrls[i].id, "name", name2var(self->ctrls[i].name), "min", self->ctrls[i].minimum, "max", self->ctrls[i].maximum, "step", self->ctrls[i].step, "default", self->ctrls[i].default_value, "value", Camera_get_V4L2_CID(self, self->ctrls[i].id)));
+		if (self->ctrls[i].type != V4L2_CTRL_TYPE_BUTTON && self->ctrls[i].type != V4L2_CTRL_TYPE_CTRL_CLASS) {
+			ids[n++] = self->ctrls[i].id;
+		}
+	}
+	if (n > 0 && cmv_capture_get_ctrls(&self->cap, ids, values, n, &failed)) {
+		//one bad control, read the others one by one
+		for (i = 0; i < n; i++) {
+			if (cmv_capture_get_ctrl(&self->cap, ids[i], &values[i])) {
+				values[i] = -1;
+			}
+		}
+	}
+
+	PyObject *glst = PyList_New(self->ctrls_n);
+	if (glst == NULL) {
+		return NULL;
+	}
+	for (i = 0, n = 0; i < self->ctrls_n; i++) {
+		int value = -1;
+		if (self->ctrls[i].type != V4L2_CTRL_TYPE_BUTTON && self->ctrls[i].type != V4L2_CTRL_TYPE_CTRL_CLASS) {
+			value = values[n++];
+		}
+		PyList_SET_ITEM(glst, i, Py_BuildValue("{sisssisisisisi}", "id", self->ctrls[i].id, "name", self->ctrl_names[i], "min", self->ctrls[i].minimum, "max", self->ctrls[i].maximum, "step", self->ctrls[i].step, "default", self->ctrls[i].default_value, "value", value));
 	}
 	return glst;
 }
 
+static PyObject *Camera_get_sequence(Camera *self) {
+	return Py_BuildValue("I", self->cap.frame_seq);
+}
+
 static PyObject *CameraShape(Camera *self) {
 	//return tuple (height, width)
-	return Py_BuildValue("(ii)", self->height, self->width);
+	return Py_BuildValue("(ii)", self->vis.height, self->vis.width);
 }
 
 static PyObject *CameraOpened(Camera *self) {
 	//camera selected? return bool
-	return Py_BuildValue("b", !(self->fd < 0));
+	return Py_BuildValue("b", !(self->cap.fd < 0));
 }
 static PyObject *CameraStarted(Camera *self) {
 	//camera started? return bool
-	return Py_BuildValue("b", self->started);
+	return Py_BuildValue("b", self->cap.started);
+}
+
+static void Camera_raise(void) {
+	//set python exception from errno of failed capture
+	if (errno == ENODATA) {
+		PyErr_SetString(PyExc_EOFError, "End of recording");
+	} else if (errno == EBADMSG) {
+		PyErr_SetString(PyExc_IOError, "Corrupt recording");
+	} else {
+		PyErr_SetFromErrno(PyExc_IOError);
+	}
 }
 
 static struct v4l2_buffer Camera_fill_buffer(Camera *self) {
 	struct v4l2_buffer buffer;
-	buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	buffer.memory = V4L2_MEMORY_MMAP;
 	buffer.index = -1;
-	if(!self->buffers) {
+	if(!self->cap.buffers) {
+		PyErr_SetString(PyExc_IOError, "Buffers have not been created");
 		return buffer;
 	}
+	for (;;) {
+		//wait until buffer is filled, other python threads run meanwhile
+		int ready;
+		self->pending = 1;
+		Py_BEGIN_ALLOW_THREADS
+		ready = cmv_capture_wait(&self->cap, 2000);
+		Py_END_ALLOW_THREADS
+		self->pending = 0;
+		if (ready > 0) {
+			break;
+		}
+		if (ready == 0) {
+			PyErr_SetString(PyExc_IOError, "Timeout waiting for frame");
+			return buffer;
+		}
+		if (errno != EINTR) {
+			PyErr_SetFromErrno(PyExc_IOError);
+			return buffer;
+		}
+		if (PyErr_CheckSignals()) {
+			return buffer;
+		}
+	}
 
-	fd_set fds;
-	struct timeval tv;
-	 
-	FD_ZERO(&fds);
-	FD_SET(self->fd, &fds);
-	 
-	tv.tv_sec = 2;//timeout
-	tv.tv_usec = 0;
-
-	while (select(self->fd + 1, &fds, NULL, NULL, &tv) <= 0);//wait until buffer is filled
-
-	if(my_ioctl(self->fd, VIDIOC_DQBUF, &buffer)) {
-		return buffer;
+	if (cmv_capture_dequeue(&self->cap, &buffer)) {
+		Camera_raise();
+		buffer.index = -1;
 	}
 	return buffer;
 }
 
-static PyObject *Camera_read(Camera *self, PyObject *args) {
-	char *format = "yuv";
-	if (!PyArg_ParseTuple(args, "|s", &format)) {
-		return NULL;
-	}
+static PyObject *CameraRecord(Camera *self, PyObject *args, PyObject *kwargs) {
+	//start writing frames to a file or a ring of files
+	static char *kwlist [] = {
+		"path",
+		"frames",
+		"files",
+		NULL
+	};
+	const char *path;
+	int frames = 0;
+	int files = 0;
 
-	struct v4l2_buffer buffer = Camera_fill_buffer(self);
-	if (buffer.index == -1) {
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "s|ii", kwlist, &path, &frames, &files)) {
 		return NULL;
 	}
+	ASSERT_OPEN;
+	ASSERT_IDLE;
 
-	int w = self->width;
-	int h = self->height;
-	int xy;
-	unsigned char* f = (unsigned char*)self->buffers[buffer.index].start;
+	if (cmv_record_start(&self->cap, path, frames, files)) {
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+	}
+	Py_RETURN_NONE;
+}
 
-	typedef enum {PX_RGB, PX_BGR, PX_YUV} pxformat_enum;
-	pxformat_enum pxformat;
+static PyObject *CameraUsePool(Camera *self, PyObject *args, PyObject *kwargs) {
+// Captures into caller buffers instead of driver buffers, so frames need
+// no copy: writable buffer objects are passed to the driver as USERPTR,
+// ints as dmabuf fds to import. Returns False if the driver refused and
+// its own buffers are used again.
+	static char *kwlist [] = {
+		"pool",
+		"size",
+		NULL
+	};
+	PyObject *pool = Py_None;
+	PyObject *seq = NULL;
+	Py_ssize_t size = 0;
+	Py_buffer *views = NULL;
+	void **starts = NULL;
+	int *fds = NULL;
+	unsigned int memory = V4L2_MEMORY_MMAP;
+	size_t frame, length = 0;
+	int i, n = 0, got = 0;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|On", kwlist, &pool, &size)) {
+		return NULL;
+	}
+	ASSERT_OPEN;
+	ASSERT_IDLE;
+	if (cmv_capture_frame_size(&self->cap, &frame)) {
+		return PyErr_SetFromErrno(PyExc_IOError);
+	}
+
+	if (pool != Py_None) {
+		seq = PySequence_Fast(pool, "pool must be a sequence of buffers or dmabuf fds");
+		if (seq == NULL) {
+			return NULL;
+		}
+		n = PySequence_Fast_GET_SIZE(seq);
+		views = (Py_buffer *)calloc(n + 1, sizeof(Py_buffer));
+		starts = (void **)calloc(n + 1, sizeof(void *));
+		fds = (int *)calloc(n + 1, sizeof(int));
+		if (views == NULL || starts == NULL || fds == NULL) {
+			PyErr_NoMemory();
+			goto fail;
+		}
+		if (n == 0) {
+			PyErr_SetString(PyExc_ValueError, "Empty pool");
+			goto fail;
+		}
+		PyObject *first = PySequence_Fast_GET_ITEM(seq, 0);
+#if PY_MAJOR_VERSION < 3
+		memory = PyInt_Check(first) || PyLong_Check(first) ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_USERPTR;
+#else
+		memory = PyLong_Check(first) ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_USERPTR;
+#endif
+		length = memory == V4L2_MEMORY_DMABUF ? max((size_t)size, frame) : 0;
+		for (i = 0; i < n; i++) {
+			PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+			if (memory == V4L2_MEMORY_DMABUF) {
+				long fd = PyLong_AsLong(item);
+				if (fd == -1 && PyErr_Occurred()) {
+					goto fail;
+				}
+				fds[i] = (int)fd;
+				continue;
+			}
+			if (PyObject_GetBuffer(item, &views[i], PyBUF_CONTIG)) {
+				goto fail;
+			}
+			got = i + 1;
+			if ((size_t)views[i].len < frame) {
+				PyErr_Format(PyExc_ValueError, "Pool buffers must hold %lu bytes", (unsigned long)frame);
+				goto fail;
+			}
+			starts[i] = views[i].buf;
+			if (i == 0 || (size_t)views[i].len < length) {
+				length = views[i].len;
+			}
+		}
+		Py_CLEAR(seq);
+	}
+
+	int result = cmv_capture_set_pool(&self->cap, memory, starts, fds, length, n);
+	int err = errno;
+	//the old pool is out of use either way
+	Camera_free_pool(self);
+	free(starts);
+	free(fds);
+	if (self->cap.buffers != NULL && memory != V4L2_MEMORY_MMAP && self->cap.memory == memory) {
+		self->pool = views;
+		self->pool_n = got;
+	} else {
+		for (i = 0; i < got; i++) {
+			PyBuffer_Release(&views[i]);
+		}
+		free(views);
+	}
+	if (self->cap.buffers == NULL || (result && self->cap.memory == memory)) {
+		errno = err;
+		return PyErr_SetFromErrno(PyExc_IOError);
+	}
+	return PyBool_FromLong(result == 0);
+
+fail:
+	for (i = 0; i < got; i++) {
+		PyBuffer_Release(&views[i]);
+	}
+	free(views);
+	free(starts);
+	free(fds);
+	Py_XDECREF(seq);
+	return NULL;
+}
+
+static PyObject *CameraGetFrameIndex(Camera *self) {
+	//pool buffer holding the last analysed frame, -1 if none
+	ASSERT_IDLE;
+	return Py_BuildValue("i", self->holding ? (int)self->held.index : -1);
+}
+
+static PyObject *CameraStopRecording(Camera *self) {
+	ASSERT_IDLE;
+	cmv_record_stop(&self->cap);
+	if (cmv_record_error(&self->cap)) {
+		return PyErr_SetFromErrno(PyExc_IOError);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *Camera_read(Camera *self, PyObject *args) {
+	char *format = "yuv";
+	if (!PyArg_ParseTuple(args, "|s", &format)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+
+	struct v4l2_buffer buffer = Camera_fill_buffer(self);
+	if (buffer.index == -1) {
+		return NULL;
+	}
+
+	int w = self->vis.width;
+	int h = self->vis.height;
+	int xy;
+	unsigned char* f = (unsigned char*)self->cap.buffers[buffer.index].start;
+	unsigned char *img = Output_next(&self->img_out, (size_t)w * h * 3);
+	if (img == NULL) {
+		cmv_capture_release(&self->cap, &buffer);
+		return NULL;
+	}
+
+	typedef enum {PX_RGB, PX_BGR, PX_YUV} pxformat_enum;
+	pxformat_enum pxformat;
 	if (strcmp(format, "rgb") == 0) {
 		pxformat = PX_RGB;
 	} else if (strcmp(format, "bgr") == 0) {
@@ -564,14 +964,14 @@ static PyObject *Camera_read(Camera *self, PyObject *args) {
 			v *= 409;
 
 			int y = 298 * (f[2*xy] - 16);
-			self->img[3*xy+1-rb] = CLAMP(y + v);
-			self->img[3*xy+1] = CLAMP(y - uv);
-			self->img[3*xy+1+rb] = CLAMP(y + u);
+			img[3*xy+1-rb] = CLAMP(y + v);
+			img[3*xy+1] = CLAMP(y - uv);
+			img[3*xy+1+rb] = CLAMP(y + u);
 
 			y = 298 * (f[2*xy+2] - 16);
-			self->img[3*xy+4-rb] = CLAMP(y + v);
-			self->img[3*xy+4] = CLAMP(y - uv);
-			self->img[3*xy+4+rb] = CLAMP(y + u);
+			img[3*xy+4-rb] = CLAMP(y + v);
+			img[3*xy+4] = CLAMP(y - uv);
+			img[3*xy+4+rb] = CLAMP(y + u);
 		}
 		#undef CLAMP
 	} else {
@@ -580,486 +980,2794 @@ static PyObject *Camera_read(Camera *self, PyObject *args) {
 			int u = f[2*xy+1];
 			int y2 = f[2*xy+2];
 			int v = f[2*xy+3];
-			self->img[3*xy] = y1;
-			self->img[3*xy+1] = u;
-			self->img[3*xy+2] = v;
-			self->img[3*xy+3] = y2;
-			self->img[3*xy+4] = u;
-			self->img[3*xy+5] = v;
+			img[3*xy] = y1;
+			img[3*xy+1] = u;
+			img[3*xy+2] = v;
+			img[3*xy+3] = y2;
+			img[3*xy+4] = u;
+			img[3*xy+5] = v;
+		}
+	}
+
+
+	if(cmv_capture_release(&self->cap, &buffer)) {
+		return PyErr_SetFromErrno(PyExc_IOError);
+	}
+
+	npy_intp dims[3] = {self->vis.height, self->vis.width, 3};
+	return Output_view(&self->img_out, 3, dims, NPY_UINT8);
+}
+
+static PyObject *CameraSetColorMinArea(Camera *self, PyObject *args) {
+	//set min blob size
+	int color;
+	int min_area;
+
+	if (!PyArg_ParseTuple(args, "ii", &color, &min_area)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	if (color < COLOR_COUNT) {
+		self->cfg.classes[color].min_area = min_area;
+		cmv_config_changed(&self->cfg);//cached runs skip untracked colors
+	}
+	
+	Py_RETURN_NONE;
+}
+
+static PyObject *CameraSetBlobFilter(Camera *self, PyObject *args, PyObject *kwargs) {
+	//set shape, distance and position limits of color blobs
+	static char *kwlist [] = {
+		"color_id",
+		"max_area",
+		"min_aspect",
+		"max_aspect",
+		"min_fill",
+		"min_distance",
+		"max_distance",
+		"min_y",
+		"max_y",
+		NULL
+	};
+	int color;
+	cmv_class f;
+	CLEAR(f);
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "i|ifffiiii", kwlist, &color, &f.max_area, &f.min_aspect, &f.max_aspect,
+			&f.min_fill, &f.min_r, &f.max_r, &f.min_y, &f.max_y)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	if (color < 0 || color >= COLOR_COUNT) {
+		PyErr_SetString(PyExc_ValueError, "Invalid color_id");
+		return NULL;
+	}
+	if (f.max_area < 0 || f.min_aspect < 0 || f.max_aspect < 0 || f.min_fill < 0 || f.min_r < 0 || f.max_r < 0) {
+		PyErr_SetString(PyExc_ValueError, "Limits must not be negative");
+		return NULL;
+	}
+	if (f.min_y && !f.max_y) {
+		f.max_y = MAX_INT;
+	}
+	if (f.min_r && !f.max_r) {
+		f.max_r = MAX_INT;
+	}
+
+	cmv_class *c = &self->cfg.classes[color];
+	c->max_area = f.max_area;
+	c->min_aspect = f.min_aspect;
+	c->max_aspect = f.max_aspect;
+	c->min_fill = f.min_fill;
+	c->min_r = f.min_r;
+	c->max_r = f.max_r;
+	c->min_y = f.min_y;
+	c->max_y = f.max_y;
+	c->filter = f.max_area || f.min_aspect || f.max_aspect || f.min_fill || f.max_r || f.max_y;
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *CameraSetMorphology(Camera *self, PyObject *args, PyObject *kwargs) {
+	//set run length open/close of color
+	static char *kwlist [] = {
+		"color_id",
+		"open_w",
+		"close_w",
+		"open_h",
+		"close_h",
+		NULL
+	};
+	int color;
+	int open_w = 0;
+	int close_w = 0;
+	int open_h = 0;
+	int close_h = 0;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "i|iiii", kwlist, &color, &open_w, &close_w, &open_h, &close_h)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	if (color < 0 || color >= COLOR_COUNT) {
+		PyErr_SetString(PyExc_ValueError, "Invalid color_id");
+		return NULL;
+	}
+	if (open_w < 0 || close_w < 0 || close_h < 0) {
+		PyErr_SetString(PyExc_ValueError, "Sizes must not be negative");
+		return NULL;
+	}
+	self->cfg.classes[color].open_w = open_w;
+	self->cfg.classes[color].close_w = close_w > 0 ? close_w : -1;
+	self->cfg.classes[color].open_h = open_h != 0;
+	self->cfg.classes[color].close_h = close_h;
+
+	cmv_config_changed(&self->cfg);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *CameraSetColors(Camera *self, PyObject *args) {
+	//set colortable
+	PyObject *arg1=NULL;
+	PyArrayObject *lookup=NULL;
+
+	if (!PyArg_ParseTuple(args, "O!", &PyArray_Type, &arg1)) return NULL;
+	ASSERT_IDLE;
+	lookup = (PyArrayObject*)PyArray_FROM_OTF(arg1, NPY_UINT8, NPY_ARRAY_IN_ARRAY);
+	if (lookup == NULL) {
+		Py_XDECREF(lookup);
+		return NULL;
+	}
+	
+	unsigned char *data = (unsigned char*)PyArray_DATA(lookup);
+	unsigned long size = min(0x1000000, (unsigned long)PyArray_NBYTES(lookup));
+	memcpy(self->cfg.colors_lookup, data, size);
+	cmv_config_changed(&self->cfg);
+	
+	Py_DECREF(lookup);
+	Py_RETURN_NONE;
+}
+
+static PyObject *CameraSetActivePixels(Camera *self, PyObject *args) {
+	//set colortable
+	PyObject *arg1=NULL;
+	PyArrayObject *pixels=NULL;
+
+	if (!PyArg_ParseTuple(args, "O!", &PyArray_Type, &arg1)) return NULL;
+	ASSERT_IDLE;
+	pixels = (PyArrayObject*)PyArray_FROM_OTF(arg1, NPY_UINT8, NPY_ARRAY_IN_ARRAY);
+	if (pixels == NULL) {
+		Py_XDECREF(pixels);
+		return NULL;
+	}
+	
+	unsigned char *data = (unsigned char*)PyArray_DATA(pixels);
+	unsigned long size = min(MAX_WIDTH * MAX_HEIGHT, (unsigned long)PyArray_NBYTES(pixels));
+	memcpy(self->cfg.pixel_active, data, size);
+	cmv_config_changed(&self->cfg);
+	
+	Py_DECREF(pixels);
+	Py_RETURN_NONE;
+}
+
+static PyObject *CameraSetLocations(Camera *self, PyObject *args) {
+	//set location tables, either full size or sampled every step pixels
+	PyObject *arg1=NULL, *arg2=NULL;
+	PyArrayObject *d_r=NULL, *d_phi=NULL;
+	int step = 1;
+
+	if (!PyArg_ParseTuple(args, "O!O!|i", &PyArray_Type, &arg1, &PyArray_Type, &arg2, &step)) return NULL;
+	if (step < 1) {
+		PyErr_SetString(PyExc_ValueError, "step must be positive");
+		return NULL;
+	}
+	ASSERT_IDLE;
+	d_r = (PyArrayObject*)PyArray_FROM_OTF(arg1, NPY_UINT16, NPY_ARRAY_IN_ARRAY);
+	if (d_r == NULL) {
+		Py_XDECREF(d_r);
+		return NULL;
+	}
+	d_phi = (PyArrayObject*)PyArray_FROM_OTF(arg2, NPY_UINT16, NPY_ARRAY_IN_ARRAY);
+	if (d_phi == NULL) {
+		Py_XDECREF(d_phi);
+		Py_DECREF(d_r);
+		return NULL;
+	}
+
+	unsigned long size = min(PyArray_SIZE(d_r), PyArray_SIZE(d_phi));
+	int gw, gh;
+	if (PyArray_NDIM(d_r) == 2) {
+		gh = (int)PyArray_DIM(d_r, 0);
+		gw = (int)PyArray_DIM(d_r, 1);
+	} else {
+		//flat table, rows are as wide as the sampled image
+		gw = step == 1 ? self->vis.width : (self->vis.width - 1 + step - 1) / step + 1;
+		gh = gw > 0 ? size / gw : 0;
+	}
+	if ((unsigned long)gw * gh > size || gw <= 0 || gh <= 0 || (step > 1 && (gw < 2 || gh < 2))) {
+		PyErr_SetString(PyExc_ValueError, "Invalid location table shape");
+		Py_DECREF(d_r);
+		Py_DECREF(d_phi);
+		return NULL;
+	}
+
+	int result = cmv_set_locations(&self->cfg, (unsigned short *)PyArray_DATA(d_r), (unsigned short *)PyArray_DATA(d_phi), gw, gh, step);
+	Py_DECREF(d_r);
+	Py_DECREF(d_phi);
+	if (result) {
+		return PyErr_NoMemory();
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *CameraLocate(Camera *self, PyObject *args) {
+	//image coordinate to (distance, angle)
+	float x, y;
+	unsigned short r, phi;
+	if (!PyArg_ParseTuple(args, "ff", &x, &y)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	cmv_locate(&self->cfg, x, y, &r, &phi);
+	return Py_BuildValue("(ii)", r, phi);
+}
+
+static int track_pair_cmp(const void *a, const void *b) {
+	float d = ((const track_pair *)a)->cost - ((const track_pair *)b)->cost;
+	return (d > 0) - (d < 0);
+}
+
+static void Camera_track_update(Camera *self, track *t, region *p, float dt) {
+	unsigned short r, phi;
+	float a = t->hits == 1 ? 1.0f : TRACK_SMOOTHING;
+	cmv_locate(&self->cfg, p->cen_x, p->cen_y, &r, &phi);
+	if (dt > 0 && t->hits > 0) {
+		t->vx += a * ((p->cen_x - t->x) / dt - t->vx);
+		t->vy += a * ((p->cen_y - t->y) / dt - t->vy);
+		t->vr += a * (((float)r - t->r) / dt - t->vr);
+		t->vphi += a * ((short)(phi - (unsigned short)t->phi) / dt - t->vphi);
+	}
+	t->x = p->cen_x;
+	t->y = p->cen_y;
+	t->r = r;
+	t->phi = phi;
+	t->x1 = p->x1;
+	t->y1 = p->y1;
+	t->x2 = p->x2;
+	t->y2 = p->y2;
+	t->area = p->area;
+	t->hits++;
+	t->missed = 0;
+}
+
+static void Camera_track_regions(Camera *self, int c, float dt) {
+// Associates the regions of one color with its tracks. Tracks are
+// predicted forward with their velocity, every track/region pair
+// within the gate (or with the region centroid inside the predicted
+// bounding box) is a candidate, and candidates are assigned greedily
+// by distance. Unmatched regions start tentative tracks, largest
+// first. Tentative tracks die on their first miss, confirmed ones
+// after max_missed misses.
+	color_tracker *tr = &self->trackers[c];
+	region *p;
+	int i, j, n = 0;
+
+	// regions are sorted by area, so births prefer large blobs
+	for (p = cmv_sorted_list(&self->vis, c); p != NULL; p = p->next) {
+		p->iterator_id = 0; // used to mark assigned regions
+	}
+
+	for (i = 0; i < tr->num; i++) {
+		track *t = &tr->tracks[i];
+		float px = t->x + t->vx * dt;
+		float py = t->y + t->vy * dt;
+		float dx = px - t->x;
+		float dy = py - t->y;
+		for (p = self->vis.colors[c].list; p != NULL; p = p->next) {
+			float cost = hypotf(p->cen_x - px, p->cen_y - py);
+			if (cost > tr->gate && !(p->cen_x >= t->x1 + dx && p->cen_x <= t->x2 + dx && p->cen_y >= t->y1 + dy && p->cen_y <= t->y2 + dy)) {
+				continue;
+			}
+			if (n == self->pairs_cap) {
+				int cap = max(256, 2 * n);
+				track_pair *pairs = (track_pair *)realloc(self->pairs, cap * sizeof(track_pair));
+				if (pairs == NULL) break;
+				self->pairs = pairs;
+				self->pairs_cap = cap;
+			}
+			self->pairs[n].cost = cost;
+			self->pairs[n].track = i;
+			self->pairs[n].reg = p;
+			n++;
+		}
+	}
+	qsort(self->pairs, n, sizeof(track_pair), track_pair_cmp);
+
+	unsigned char matched[MAX_TRACKS] = {0};
+	for (j = 0; j < n; j++) {
+		track_pair *q = &self->pairs[j];
+		if (matched[q->track] || q->reg->iterator_id) continue;
+		matched[q->track] = 1;
+		q->reg->iterator_id = 1;
+		Camera_track_update(self, &tr->tracks[q->track], q->reg, dt);
+	}
+
+	// coast or drop unmatched tracks
+	for (i = 0, j = 0; i < tr->num; i++) {
+		track *t = &tr->tracks[i];
+		t->age++;
+		if (!matched[i]) {
+			t->missed++;
+			int dx = (int)round(t->vx * dt);
+			int dy = (int)round(t->vy * dt);
+			t->x += t->vx * dt;
+			t->y += t->vy * dt;
+			t->x1 += dx;
+			t->x2 += dx;
+			t->y1 += dy;
+			t->y2 += dy;
+			t->r += t->vr * dt;
+			t->phi = fmodf(t->phi + t->vphi * dt + 65536.0f, 65536.0f);
+			if (!t->confirmed || t->missed > tr->max_missed) {
+				continue;
+			}
+		} else if (t->hits >= tr->confirm) {
+			t->confirmed = 1;
+		}
+		tr->tracks[j++] = *t;
+	}
+	tr->num = j;
+
+	// start tentative tracks from unmatched regions
+	for (p = self->vis.colors[c].list; p != NULL && tr->num < MAX_TRACKS; p = p->next) {
+		if (p->iterator_id) continue;
+		track *t = &tr->tracks[tr->num++];
+		memset(t, 0, sizeof(track));
+		t->id = ++self->track_id;
+		Camera_track_update(self, t, p, dt);
+		t->confirmed = tr->confirm <= 1;
+	}
+	for (p = self->vis.colors[c].list; p != NULL; p = p->next) {
+		p->iterator_id = 0;
+	}
+}
+
+static void Camera_track(Camera *self) {
+	int c;
+	float dt = 0;
+	if (self->cap.frame_time > self->track_time) {
+		dt = (self->cap.frame_time - self->track_time) / 1000000.0f;
+	}
+	self->track_time = self->cap.frame_time;
+
+	for (c = 0; c < COLOR_COUNT; c++) {
+		if (self->trackers[c].gate > 0) {
+			Camera_track_regions(self, c, dt);
+		}
+	}
+}
+
+static int Camera_auto_exposure(Camera *self) {
+// Moves the exposure control towards the target mean luma. The step
+// is proportional in log domain, so it behaves the same on dark and
+// bright scenes. A failed write disables auto exposure and returns -1
+// with errno set.
+	unsigned long long sum = 0, n = 0;
+	int i;
+	for (i = 0; i < 256; i++) {
+		sum += (unsigned long long)i * self->vis.hist[0][i];
+		n += self->vis.hist[0][i];
+	}
+	if (n == 0) return 0;
+
+	double mean = max((double)sum / n, 1.0);
+	if (fabs(mean - self->ae_target) <= self->ae_deadband) return 0;
+
+	double value = self->ae_value * pow(self->ae_target / mean, self->ae_gain);
+	value = min(max(value, (double)self->ae_min), (double)self->ae_max);
+	int next = (int)round(value);
+	if (next == self->ae_value) {
+		//make sure small errors still move the control
+		next += self->ae_target > mean ? 1 : -1;
+		next = min(max(next, self->ae_min), self->ae_max);
+	}
+	if (next != self->ae_value) {
+		if (cmv_capture_set_ctrl(&self->cap, self->ae_id, next)) {
+			self->ae_target = 0;
+			self->cfg.stats = self->stats_on;
+			return -1;
+		}
+		self->ae_value = next;
+	}
+	return 0;
+}
+
+static void Camera_publish(Camera *self) {
+// Writes blobs (and segmented image) of the analysed frame into the
+// next shared memory slot. Slot generation is odd while it is written,
+// subscribers retry when it changes under them.
+	shm_header *hdr = (shm_header *)self->shm;
+	unsigned long long n = hdr->latest;
+	unsigned int i;
+	char *base = (char *)hdr + SHM_HEADER_SIZE + (n % hdr->slot_count) * hdr->slot_size;
+	shm_slot *slot = (shm_slot *)base;
+	unsigned short *blobs = (unsigned short *)(base + sizeof(shm_slot));
+
+	__atomic_store_n(&slot->gen, slot->gen + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->seq = self->cap.frame_seq;
+	slot->time = self->cap.frame_time;
+	for (i = 0; i < hdr->color_n; i++) {
+		slot->counts[i] = cmv_fill_blobs(&self->vis, hdr->colors[i], &blobs[i * hdr->max_blobs * 9], hdr->max_blobs);
+	}
+	if (hdr->has_segmented) {
+		memcpy(base + hdr->segmented_offset, self->vis.segmented, hdr->width * hdr->height);
+	}
+
+	__atomic_store_n(&slot->gen, slot->gen + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&hdr->latest, n + 1, __ATOMIC_RELEASE);
+}
+
+static void Camera_unpublish(Camera *self) {
+	if (self->shm != NULL) {
+		munmap(self->shm, self->shm_size);
+		shm_unlink(self->shm_name);
+		self->shm = NULL;
+	}
+	if (self->shm_name != NULL) {
+		free(self->shm_name);
+		self->shm_name = NULL;
+	}
+}
+
+static void Camera_segment(Camera *self, unsigned char *frame) {
+// Runs the whole segmentation pipeline on one YUYV frame. Does not
+// touch python state, so it can run without the GIL.
+	cmv_segment(&self->vis, frame);
+
+	Camera_track(self);
+
+	if (self->shm != NULL) {
+		Camera_publish(self);
+	}
+}
+
+static int Camera_release_analysed(Camera *self, struct v4l2_buffer *buffer) {
+	//give the buffer of an analysed frame back, a pool buffer is held until
+	//the next frame is analysed so the caller can read the frame from it
+	if (self->cap.memory != V4L2_MEMORY_MMAP) {
+		struct v4l2_buffer previous = self->held;
+		int holding = self->holding;
+		self->held = *buffer;
+		self->holding = 1;
+		return holding ? cmv_capture_release(&self->cap, &previous) : 0;
+	}
+	return cmv_capture_release(&self->cap, buffer);
+}
+
+static PyObject *Camera_process_buffer(Camera *self, struct v4l2_buffer *buffer) {
+	//segment dequeued frame without the GIL and give the buffer back
+	int err = 0;
+	if (Camera_next_segmented(self)) {
+		cmv_capture_release(&self->cap, buffer);
+		return NULL;
+	}
+	self->pending = 1;
+	Py_BEGIN_ALLOW_THREADS
+	Camera_segment(self, (unsigned char*)self->cap.buffers[buffer->index].start);
+	if (Camera_release_analysed(self, buffer)) {
+		err = errno;
+	} else if (self->ae_target > 0 && Camera_auto_exposure(self)) {
+		err = errno;
+	}
+	Py_END_ALLOW_THREADS
+	self->pending = 0;
+
+	if (err || cmv_record_error(&self->cap)) {
+		//the frame is analysed even when recording it failed
+		errno = err ? err : errno;
+		return PyErr_SetFromErrno(PyExc_IOError);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *CameraAnalyse(Camera *self) {
+	ASSERT_IDLE;
+	struct v4l2_buffer buffer = Camera_fill_buffer(self);
+	if (buffer.index == -1) {
+		return NULL;
+	}
+
+	return Camera_process_buffer(self, &buffer);
+}
+
+static PyObject *CameraTryAnalyse(Camera *self) {
+	//analyse frame if one is ready, never wait
+	ASSERT_OPEN;
+	ASSERT_IDLE;
+	struct v4l2_buffer buffer;
+	if (cmv_capture_dequeue(&self->cap, &buffer)) {
+		if (errno == EAGAIN) {
+			Py_RETURN_FALSE;
 		}
+		Camera_raise();
+		return NULL;
+	}
+
+	PyObject *result = Camera_process_buffer(self, &buffer);
+	if (result == NULL) {
+		return NULL;
 	}
+	Py_DECREF(result);
+	Py_RETURN_TRUE;
+}
+
+typedef struct {
+	blob_record *blobs;
+	int n, cap;
+} batch_chunk;
 
+typedef struct {
+	cmv_config *cfg;
+	const unsigned char **frames;
+	int count, width, height;
+	const unsigned char *colors;
+	int colors_n;
+	batch_chunk *chunks;
+	int chunks_n;
+	int next;//next chunk to take, shared by the workers
+	int err;//first errno of any worker
+} batch_job;
+
+static int batch_add(batch_chunk *chunk, cmv_vision *vis, int frame, int color) {
+	//append blobs of color in getBlobs() order, -1 when out of memory
+	region *p;
+	for (p = cmv_sorted_list(vis, color); p != NULL; p = p->next) {
+		if (chunk->n == chunk->cap) {
+			int cap = chunk->cap ? chunk->cap * 2 : 64;
+			blob_record *blobs = (blob_record *)realloc(chunk->blobs, cap * sizeof(blob_record));
+			if (blobs == NULL) {
+				return -1;
+			}
+			chunk->blobs = blobs;
+			chunk->cap = cap;
+		}
+		blob_record *b = &chunk->blobs[chunk->n++];
+		b->frame = frame;
+		b->color = color;
+		cmv_locate(vis->config, p->cen_x, p->cen_y, &b->distance, &b->angle);
+		b->area = p->area;
+		b->cen_x = p->cen_x;
+		b->cen_y = p->cen_y;
+		b->x1 = p->x1;
+		b->x2 = p->x2;
+		b->y1 = p->y1;
+		b->y2 = p->y2;
+	}
+	return 0;
+}
 
-	if(my_ioctl(self->fd, VIDIOC_QBUF, &buffer)) {
+static void *batch_run(void *arg) {
+// Worker of analyseBatch(). Has its own pipeline on the shared config
+// and takes chunks of consecutive frames until none are left, so the
+// incremental cache still helps within a chunk and slow frames do not
+// stall the rest.
+	batch_job *job = (batch_job *)arg;
+	cmv_vision *vis = cmv_create(job->cfg, job->width, job->height);
+	int chunk, f, c;
+
+	if (vis == NULL) {
+		__sync_bool_compare_and_swap(&job->err, 0, ENOMEM);
 		return NULL;
 	}
-
-	npy_intp dims[3] = {self->height, self->width, 3};
-	PyArrayObject *outArray = (PyArrayObject *) PyArray_SimpleNewFromData(3, dims, NPY_UINT8, self->img);
-	return PyArray_Return(outArray);
+	while (__atomic_load_n(&job->err, __ATOMIC_RELAXED) == 0 && (chunk = __sync_fetch_and_add(&job->next, 1)) < job->chunks_n) {
+		int end = min((chunk + 1) * BATCH_CHUNK, job->count);
+		// classify the first frame of a chunk fully, so results do not
+		// depend on which frames this worker saw before
+		vis->inc_valid = 0;
+		for (f = chunk * BATCH_CHUNK; f < end; f++) {
+			cmv_segment(vis, job->frames[f]);
+			for (c = 0; c < job->colors_n; c++) {
+				if (batch_add(&job->chunks[chunk], vis, f, job->colors[c])) {
+					__sync_bool_compare_and_swap(&job->err, 0, ENOMEM);
+					break;
+				}
+			}
+		}
+	}
+	cmv_destroy(vis);
+	return NULL;
+}
+
+static void batch_segment(batch_job *job, int threads) {
+	//run threads workers, one of them in the calling thread
+	pthread_t *tids = (pthread_t *)malloc(threads * sizeof(pthread_t));
+	int i, started = 0;
+
+	for (i = 1; tids != NULL && i < threads; i++) {
+		if (pthread_create(&tids[started], NULL, batch_run, job) == 0) {
+			started++;
+		}
+	}
+	batch_run(job);
+	for (i = 0; i < started; i++) {
+		pthread_join(tids[i], NULL);
+	}
+	free(tids);
+}
+
+static PyObject *CameraAnalyseBatch(Camera *self, PyObject *args, PyObject *kwargs) {
+// Segments many frames in parallel without the GIL and returns their
+// blobs as one BLOB_DTYPE array ordered by frame, color and area.
+	static char *kwlist [] = {
+		"frames",
+		"colors",
+		"threads",
+		NULL
+	};
+	PyObject *frames;
+	PyObject *colors = NULL;
+	int threads = 0;
+	PyArrayObject *array = NULL;
+	cmv_recording rec;
+	PyObject *path_obj = NULL;
+	const char *path = NULL;
+	unsigned char color_ids[COLOR_COUNT];
+	batch_job job;
+	npy_intp total = 0;
+	int i;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Oi", kwlist, &frames, &colors, &threads)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	memset(&job, 0, sizeof(job));
+	if (colors == NULL || colors == Py_None) {
+		for (i = 0; i < COLOR_COUNT; i++) {
+			color_ids[i] = i;
+		}
+		job.colors_n = COLOR_COUNT;
+	} else {
+		PyObject *seq = PySequence_Fast(colors, "colors must be a sequence of color ids");
+		if (seq == NULL) {
+			return NULL;
+		}
+		if (PySequence_Fast_GET_SIZE(seq) > COLOR_COUNT) {
+			Py_DECREF(seq);
+			PyErr_SetString(PyExc_ValueError, "Too many colors");
+			return NULL;
+		}
+		for (i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+			long color = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+			if (color < 0 || color >= COLOR_COUNT) {
+				Py_DECREF(seq);
+				if (!PyErr_Occurred()) {
+					PyErr_SetString(PyExc_ValueError, "Invalid color_id");
+				}
+				return NULL;
+			}
+			color_ids[i] = color;
+		}
+		job.colors_n = i;
+		Py_DECREF(seq);
+	}
+	job.colors = color_ids;
+	job.cfg = &self->cfg;
+
+	if (PyUnicode_Check(frames) || PyBytes_Check(frames) || PyObject_HasAttrString(frames, "__fspath__")) {
+		//recording of record(), its frames are read straight from the page cache
+#if PY_MAJOR_VERSION >= 3
+		if (!PyUnicode_FSConverter(frames, &path_obj)) {
+			return NULL;
+		}
+		path = PyBytes_AS_STRING(path_obj);
+#else
+		if (!PyArg_Parse(frames, "s", &path)) {
+			return NULL;
+		}
+#endif
+		if (cmv_recording_map(&rec, path)) {
+			if (errno == EBADMSG) {
+				PyErr_Format(PyExc_IOError, "%s is not a YUYV recording", path);
+			} else {
+				PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+			}
+			Py_XDECREF(path_obj);
+			return NULL;
+		}
+		job.frames = rec.frames;
+		job.count = rec.count;
+		job.width = rec.width;
+		job.height = rec.height;
+	} else {
+		array = (PyArrayObject *)PyArray_FROMANY(frames, NPY_UINT8, 3, 3, NPY_ARRAY_IN_ARRAY);
+		if (array == NULL) {
+			return NULL;
+		}
+		job.count = PyArray_DIM(array, 0);
+		job.height = PyArray_DIM(array, 1);
+		job.width = PyArray_DIM(array, 2) / 2;
+		if (PyArray_DIM(array, 2) % 4 || job.width == 0 || job.width > MAX_WIDTH || job.height == 0 || job.height > MAX_HEIGHT) {
+			Py_DECREF(array);
+			PyErr_SetString(PyExc_ValueError, "frames must be YUYV images of shape (N, h, w*2) with even w");
+			return NULL;
+		}
+		job.frames = (const unsigned char **)malloc(max(job.count, 1) * sizeof(unsigned char *));
+		if (job.frames == NULL) {
+			Py_DECREF(array);
+			return PyErr_NoMemory();
+		}
+		for (i = 0; i < job.count; i++) {
+			job.frames[i] = (const unsigned char *)PyArray_GETPTR1(array, i);
+		}
+	}
+
+	job.chunks_n = (job.count + BATCH_CHUNK - 1) / BATCH_CHUNK;
+	job.chunks = (batch_chunk *)calloc(max(job.chunks_n, 1), sizeof(batch_chunk));
+	if (threads <= 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	threads = max(1, min(threads, job.chunks_n));
+
+	if (job.chunks == NULL) {
+		job.err = ENOMEM;
+	} else {
+		self->pending = 1;//config must not change while the workers read it
+		Py_BEGIN_ALLOW_THREADS
+		batch_segment(&job, threads);
+		Py_END_ALLOW_THREADS
+		self->pending = 0;
+	}
+
+	PyArrayObject *outArray = NULL;
+	if (job.err) {
+		errno = job.err;
+		PyErr_SetFromErrno(job.err == ENOMEM ? PyExc_MemoryError : PyExc_IOError);
+	} else {
+		for (i = 0; i < job.chunks_n; i++) {
+			total += job.chunks[i].n;
+		}
+		Py_INCREF(blob_descr);
+		outArray = (PyArrayObject *)PyArray_NewFromDescr(&PyArray_Type, blob_descr, 1, &total, NULL, NULL, 0, NULL);
+		if (outArray != NULL) {
+			blob_record *out = (blob_record *)PyArray_DATA(outArray);
+			for (i = 0; i < job.chunks_n; i++) {
+				memcpy(out, job.chunks[i].blobs, job.chunks[i].n * sizeof(blob_record));
+				out += job.chunks[i].n;
+			}
+		}
+	}
+
+	for (i = 0; job.chunks != NULL && i < job.chunks_n; i++) {
+		free(job.chunks[i].blobs);
+	}
+	free(job.chunks);
+	if (path != NULL) {
+		cmv_recording_unmap(&rec);
+		Py_XDECREF(path_obj);
+	} else {
+		free(job.frames);
+		Py_DECREF(array);
+	}
+	return (PyObject *)outArray;
+}
+
+static PyObject *CameraFileno(Camera *self) {
+	//device file descriptor, readable when a frame is ready
+	ASSERT_OPEN;
+	return Py_BuildValue("i", self->cap.fd);
+}
+
+typedef struct async_job {
+	Camera *cam;
+	PyObject *loop;
+	PyObject *future;
+	PyObject *capsule;//owns the job, borrowed
+	struct v4l2_buffer buffer;
+	unsigned char running;//a segmentation thread uses the job
+} async_job;
+
+static void future_set_errno(PyObject *future, int err) {
+	//fail future with the exception analyse() would raise
+	PyObject *type, *value, *tb, *result;
+	errno = err;
+	Camera_raise();
+	PyErr_Fetch(&type, &value, &tb);
+	PyErr_NormalizeException(&type, &value, &tb);
+	result = PyObject_CallMethod(future, "set_exception", "O", value);
+	Py_XDECREF(result);
+	Py_XDECREF(type);
+	Py_XDECREF(value);
+	Py_XDECREF(tb);
+	PyErr_Clear();
+}
+
+static PyObject *Camera_async_done(PyObject *state, PyObject *unused) {
+	//runs on the event loop thread, state is (future, errno)
+	PyObject *future = PyTuple_GET_ITEM(state, 0);
+	int err = (int)PyLong_AsLong(PyTuple_GET_ITEM(state, 1));
+	PyObject *done = PyObject_CallMethod(future, "done", NULL);
+	if (done == NULL) {
+		return NULL;
+	}
+	int is_done = PyObject_IsTrue(done);
+	Py_DECREF(done);
+	if (!is_done) {
+		if (err) {
+			future_set_errno(future, err);
+		} else {
+			PyObject *result = PyObject_CallMethod(future, "set_result", "O", Py_None);
+			Py_XDECREF(result);
+		}
+	}
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef async_done_def = {"_analyse_done", (PyCFunction)Camera_async_done, METH_NOARGS, NULL};
+
+static void Camera_async_free(async_job *job) {
+	Py_DECREF(job->future);
+	Py_DECREF(job->loop);
+	Py_DECREF(job->cam);
+	free(job);
+}
+
+static void Camera_async_destroy(PyObject *capsule) {
+	//capsule destructor, also runs when a closed event loop drops the reader
+	async_job *job = (async_job *)PyCapsule_GetPointer(capsule, NULL);
+	if (job->cam->async == job) {
+		job->cam->async = NULL;
+		job->cam->pending = 0;
+	}
+	Camera_async_free(job);
+}
+
+static void Camera_async_end(async_job *job) {
+	//camera is idle again, the job itself lives until its capsule is released
+	if (job->cam->async == job) {
+		job->cam->async = NULL;
+		job->cam->pending = 0;
+	}
+}
+
+static PyObject *Camera_async_cancel(PyObject *cam, PyObject *future) {
+	//done callback of the future: stop waiting when it was cancelled or timed out
+	async_job *job = ((Camera *)cam)->async;
+	PyObject *result;
+
+	if (job == NULL || job->future != future || job->running) {
+		Py_RETURN_NONE;// completed, or the thread finishes the frame and ends the job
+	}
+	Camera_async_end(job);
+	if (!job->cam->cap.replay) {
+		PyObject *loop = job->loop;
+		Py_INCREF(loop);// removing the reader may release the job
+		result = PyObject_CallMethod(loop, "remove_reader", "i", job->cam->cap.fd);
+		Py_XDECREF(result);
+		Py_DECREF(loop);
+		PyErr_Clear();
+	}
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef async_cancel_def = {"_analyse_cancel", (PyCFunction)Camera_async_cancel, METH_O, NULL};
+
+static void *Camera_async_run(void *arg) {
+	//segmentation thread of analyse_async(), completes the future on the event loop
+	async_job *job = (async_job *)arg;
+	Camera *cam = job->cam;
+	int err = 0;
+
+	Camera_segment(cam, (unsigned char*)cam->cap.buffers[job->buffer.index].start);
+	if (Camera_release_analysed(cam, &job->buffer)) {
+		err = errno;
+	} else if (cam->ae_target > 0 && Camera_auto_exposure(cam)) {
+		err = errno;
+	}
+	if (err == 0 && cmv_record_error(&cam->cap)) {
+		err = errno;
+	}
+
+	PyGILState_STATE gstate = PyGILState_Ensure();
+	job->running = 0;
+	Camera_async_end(job);
+	PyObject *state = Py_BuildValue("(Oi)", job->future, err);
+	PyObject *done = state ? PyCFunction_New(&async_done_def, state) : NULL;
+	PyObject *result = done ? PyObject_CallMethod(job->loop, "call_soon_threadsafe", "O", done) : NULL;
+	if (result == NULL) {
+		PyErr_Clear();// event loop is closed, nobody is waiting
+	}
+	Py_XDECREF(result);
+	Py_XDECREF(done);
+	Py_XDECREF(state);
+	Py_DECREF(job->capsule);
+	PyGILState_Release(gstate);
+	return NULL;
+}
+
+static PyObject *Camera_async_ready(PyObject *capsule, PyObject *unused) {
+	//event loop reader callback: dequeue frame and hand it to a segmentation thread
+	async_job *job = (async_job *)PyCapsule_GetPointer(capsule, NULL);
+	Camera *cam = job->cam;
+	PyObject *result;
+	pthread_t thread;
+	int err = 0;
+
+	PyObject *done = PyObject_CallMethod(job->future, "done", NULL);
+	int cancelled = done == NULL || PyObject_IsTrue(done) || cam->async != job;
+	Py_XDECREF(done);
+	PyErr_Clear();
+
+	if (!cancelled && cmv_capture_dequeue(&cam->cap, &job->buffer)) {
+		if (errno == EAGAIN) {
+			Py_RETURN_NONE;// not ready after all, stay registered
+		}
+		err = errno;
+	}
+	Py_INCREF(capsule);// removing the reader may drop the last other reference
+	if (!cam->cap.replay) {
+		result = PyObject_CallMethod(job->loop, "remove_reader", "i", cam->cap.fd);
+		Py_XDECREF(result);
+		PyErr_Clear();
+	}
+	if (!cancelled && !err && Camera_next_segmented(cam)) {
+		PyErr_Clear();
+		err = ENOMEM;
+		cmv_capture_release(&cam->cap, &job->buffer);
+	}
+	if (!cancelled && !err) {
+		// the thread keeps the reference to the capsule until it is done
+		job->running = 1;
+		if (pthread_create(&thread, NULL, Camera_async_run, job) == 0) {
+			pthread_detach(thread);
+			Py_RETURN_NONE;
+		}
+		job->running = 0;
+		err = errno;
+		cmv_capture_release(&cam->cap, &job->buffer);
+	}
+
+	Camera_async_end(job);
+	if (err) {
+		future_set_errno(job->future, err);
+	}
+	Py_DECREF(capsule);
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef async_ready_def = {"_analyse_ready", (PyCFunction)Camera_async_ready, METH_NOARGS, NULL};
+
+static PyObject *CameraAnalyseAsync(Camera *self) {
+	//return future completed when next frame is analysed
+	ASSERT_OPEN;
+	ASSERT_IDLE;
+	if (self->vis.perf != NULL) {
+		// every frame would run on a new thread and reopen the counters
+		PyErr_SetString(PyExc_RuntimeError, "analyse_async() cannot be used while profiling");
+		return NULL;
+	}
+	PyObject *asyncio = PyImport_ImportModule("asyncio");
+	if (asyncio == NULL) {
+		return NULL;
+	}
+	PyObject *loop = PyObject_HasAttrString(asyncio, "get_running_loop") ?
+		PyObject_CallMethod(asyncio, "get_running_loop", NULL) :
+		PyObject_CallMethod(asyncio, "get_event_loop", NULL);
+	Py_DECREF(asyncio);
+	if (loop == NULL) {
+		return NULL;
+	}
+	PyObject *future = PyObject_CallMethod(loop, "create_future", NULL);
+	if (future == NULL) {
+		Py_DECREF(loop);
+		return NULL;
+	}
+
+	async_job *job = (async_job *)malloc(sizeof(async_job));
+	if (job == NULL) {
+		Py_DECREF(loop);
+		Py_DECREF(future);
+		return PyErr_NoMemory();
+	}
+	Py_INCREF(self);
+	Py_INCREF(future);
+	job->cam = self;
+	job->loop = loop;
+	job->future = future;
+	job->running = 0;
+
+	PyObject *capsule = PyCapsule_New(job, NULL, Camera_async_destroy);
+	if (capsule == NULL) {
+		Camera_async_free(job);
+		Py_DECREF(future);
+		return NULL;
+	}
+	job->capsule = capsule;
+	PyObject *callback = PyCFunction_New(&async_ready_def, capsule);
+	Py_DECREF(capsule);// the callback owns it now
+	PyObject *cancel = PyCFunction_New(&async_cancel_def, (PyObject *)self);
+	PyObject *result = cancel ? PyObject_CallMethod(future, "add_done_callback", "O", cancel) : NULL;
+	Py_XDECREF(cancel);
+	Py_XDECREF(result);
+	if (callback == NULL || result == NULL) {
+		Py_XDECREF(callback);
+		Py_DECREF(future);
+		return NULL;
+	}
+
+	self->pending = 1;
+	self->async = job;
+	if (self->cap.replay) {
+		//recordings are always readable
+		result = PyObject_CallObject(callback, NULL);
+	} else {
+		result = PyObject_CallMethod(loop, "add_reader", "iO", self->cap.fd, callback);
+		if (result == NULL) {
+			Camera_async_end(job);
+		}
+	}
+	Py_DECREF(callback);
+	if (result == NULL) {
+		Py_DECREF(future);
+		return NULL;
+	}
+	Py_DECREF(result);
+	return future;
+}
+
+static PyObject *CameraSetStatistics(Camera *self, PyObject *args, PyObject *kwargs) {
+	//enable histogram and color counts
+	static char *kwlist [] = {
+		"enabled",
+		"uv",
+		NULL
+	};
+	int enabled = 1;
+	int uv = 0;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|ii", kwlist, &enabled, &uv)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	self->stats_on = enabled != 0;
+	self->cfg.stats = self->stats_on || self->ae_target > 0;
+	self->cfg.stats_uv = uv;
+	memset(self->vis.hist, 0, sizeof(self->vis.hist));
+	memset(self->vis.color_counts, 0, sizeof(self->vis.color_counts));
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *CameraSetIncremental(Camera *self, PyObject *args, PyObject *kwargs) {
+	//classify only tiles changed since previous frame
+	static char *kwlist [] = {
+		"tile",
+		"threshold",
+		NULL
+	};
+	int tile = 32;
+	int threshold = 2;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|ii", kwlist, &tile, &threshold)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	if (tile < 0 || tile % 8 || threshold < 0) {
+		PyErr_SetString(PyExc_ValueError, "tile must be a multiple of 8, threshold must not be negative");
+		return NULL;
+	}
+	self->cfg.inc_tile = tile;
+	self->cfg.inc_threshold = threshold;
+	cmv_config_changed(&self->cfg);
+	Py_RETURN_NONE;
+}
+
+static PyObject *CameraGetDirtyRatio(Camera *self) {
+	ASSERT_IDLE;
+	return Py_BuildValue("f", self->vis.dirty_ratio);
+}
+
+static PyObject *CameraSetCapacity(Camera *self, PyObject *args, PyObject *kwargs) {
+	//set hard caps of runs and regions per frame
+	static char *kwlist [] = {
+		"max_runs",
+		"max_regions",
+		NULL
+	};
+	int max_runs = MAX_RUNS;
+	int max_regions = MAX_REG;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|ii", kwlist, &max_runs, &max_regions)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	if (max_runs < self->vis.height || max_regions < 1) {
+		PyErr_SetString(PyExc_ValueError, "max_runs must be at least image height, max_regions positive");
+		return NULL;
+	}
+	self->cfg.max_runs = max_runs;
+	self->cfg.max_regions = max_regions;
+	Py_RETURN_NONE;
+}
+
+static PyObject *CameraSetBudget(Camera *self, PyObject *args, PyObject *kwargs) {
+	//set frame time budget and colors dropped first when over it
+	static char *kwlist [] = {
+		"ms",
+		"low_priority",
+		NULL
+	};
+	float ms = 0;
+	PyObject *low_priority = NULL;
+	unsigned char low[COLOR_COUNT];
+	int i;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|fO", kwlist, &ms, &low_priority)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	if (ms < 0) {
+		PyErr_SetString(PyExc_ValueError, "ms must not be negative");
+		return NULL;
+	}
+	memset(low, 0, sizeof(low));
+	if (low_priority != NULL && low_priority != Py_None) {
+		PyObject *seq = PySequence_Fast(low_priority, "low_priority must be a sequence of color ids");
+		if (seq == NULL) {
+			return NULL;
+		}
+		for (i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+			long color = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+			if (color < 0 || color >= COLOR_COUNT) {
+				Py_DECREF(seq);
+				if (!PyErr_Occurred()) {
+					PyErr_SetString(PyExc_ValueError, "Invalid color_id");
+				}
+				return NULL;
+			}
+			low[color] = 1;
+		}
+		Py_DECREF(seq);
+	}
+	for (i = 0; i < COLOR_COUNT; i++) {
+		self->cfg.classes[i].low_priority = low[i];
+	}
+	self->cfg.budget_us = (int)(ms * 1000);
+	self->vis.decimate = 0;
+	cmv_config_changed(&self->cfg);
+	Py_RETURN_NONE;
+}
+
+static PyObject *Camera_degradation_list(unsigned int flags) {
+	//names of CMV_DEGRADED_* and CMV_TRUNCATED_* flags
+	static const char *names[] = {"decimated", "low_priority", "morphology", "runs", "regions"};
+	PyObject *list = PyList_New(0);
+	int i;
+	if (list == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < (int)ARRAY_SIZE(names); i++) {
+		if (flags & (1 << i)) {
+			PyObject *name = Py_BuildValue("s", names[i]);
+			if (name == NULL || PyList_Append(list, name)) {
+				Py_XDECREF(name);
+				Py_DECREF(list);
+				return NULL;
+			}
+			Py_DECREF(name);
+		}
+	}
+	return list;
+}
+
+static PyObject *CameraGetDegradation(Camera *self) {
+	ASSERT_IDLE;
+	return Camera_degradation_list(self->vis.degraded);
+}
+
+static PyObject *CameraGetFrameTime(Camera *self) {
+	ASSERT_IDLE;
+	return Py_BuildValue("f", self->vis.frame_us / 1000);
+}
+
+static PyObject *CameraSetProfiling(Camera *self, PyObject *args, PyObject *kwargs) {
+	//time every stage of analyse() and count hardware events, returns the available counters
+	static char *kwlist [] = {
+		"enabled",
+		NULL
+	};
+	int enabled = 1;
+	PyObject *list;
+	int i;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &enabled)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	if (!enabled) {
+		cmv_perf_close(&self->perf);
+		self->vis.perf = NULL;
+		return PyList_New(0);
+	}
+	cmv_perf_open(&self->perf);
+	cmv_perf_reset(&self->perf);
+	self->vis.perf = &self->perf;
+
+	list = PyList_New(0);
+	for (i = 0; list != NULL && i < CMV_PERF_COUNT; i++) {
+		if (self->perf.available & (1 << i)) {
+			PyObject *name = Py_BuildValue("s", cmv_perf_names[i]);
+			if (name == NULL || PyList_Append(list, name)) {
+				Py_XDECREF(name);
+				Py_CLEAR(list);
+				break;
+			}
+			Py_DECREF(name);
+		}
+	}
+	return list;
+}
+
+static PyObject *CameraGetProfile(Camera *self, PyObject *args, PyObject *kwargs) {
+	//return {stage: {calls, total_us, min_us, max_us, counter: total or None}}
+	static char *kwlist [] = {
+		"reset",
+		NULL
+	};
+	int reset = 0;
+	PyObject *dict;
+	int i, j;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &reset)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	dict = PyDict_New();
+	if (dict == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < CMV_STAGE_COUNT; i++) {
+		const cmv_stage_stats *st = &self->perf.stages[i];
+		PyObject *stage = Py_BuildValue("{sKsdsdsd}", "calls", st->calls, "total_us", st->total_us, "min_us", st->min_us, "max_us", st->max_us);
+		if (stage == NULL) {
+			Py_DECREF(dict);
+			return NULL;
+		}
+		for (j = 0; j < CMV_PERF_COUNT; j++) {
+			PyObject *value = Py_None;
+			if (self->perf.available & (1 << j)) {
+				value = PyLong_FromUnsignedLongLong(st->counts[j]);
+			} else {
+				Py_INCREF(value);
+			}
+			if (value == NULL || PyDict_SetItemString(stage, cmv_perf_names[j], value)) {
+				Py_XDECREF(value);
+				Py_DECREF(stage);
+				Py_DECREF(dict);
+				return NULL;
+			}
+			Py_DECREF(value);
+		}
+		if (PyDict_SetItemString(dict, cmv_stage_names[i], stage)) {
+			Py_DECREF(stage);
+			Py_DECREF(dict);
+			return NULL;
+		}
+		Py_DECREF(stage);
+	}
+	if (reset) {
+		cmv_perf_reset(&self->perf);
+	}
+	return dict;
+}
+
+static PyObject *CameraSaveProfile(Camera *self, PyObject *args) {
+	//write the stage statistics as CSV
+	const char *path;
+	FILE *f;
+	int err;
+
+	if (!PyArg_ParseTuple(args, "s", &path)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	f = fopen(path, "w");
+	if (f == NULL) {
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+	}
+	err = cmv_perf_write_csv(&self->perf, f);
+	if (fclose(f) || err) {
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *CameraGetHistogram(Camera *self) {
+	//return Y histogram [256] or Y, U, V histograms [3][256]
+	ASSERT_IDLE;
+	int rows = self->cfg.stats_uv ? 3 : 1;
+	npy_intp dims[2] = {rows, 256};
+	PyArrayObject *outArray = (PyArrayObject *) PyArray_SimpleNew(rows == 1 ? 1 : 2, rows == 1 ? &dims[1] : dims, NPY_UINT32);
+	if (outArray == NULL) {
+		return NULL;
+	}
+	memcpy(PyArray_DATA(outArray), self->vis.hist, rows * sizeof(self->vis.hist[0]));
+	return PyArray_Return(outArray);
+}
+
+static PyObject *CameraGetColorCounts(Camera *self) {
+	//return pixel count of each color_id
+	ASSERT_IDLE;
+	npy_intp dims[1] = {COLOR_COUNT};
+	PyArrayObject *outArray = (PyArrayObject *) PyArray_SimpleNew(1, dims, NPY_UINT32);
+	if (outArray == NULL) {
+		return NULL;
+	}
+	memcpy(PyArray_DATA(outArray), self->vis.color_counts, COLOR_COUNT * sizeof(unsigned int));
+	return PyArray_Return(outArray);
+}
+
+static PyObject *CameraSetAutoExposure(Camera *self, PyObject *args, PyObject *kwargs) {
+	//control exposure from luma histogram, target=0 disables
+	static char *kwlist [] = {
+		"target",
+		"control",
+		"gain",
+		"deadband",
+		NULL
+	};
+	double target;
+	char *param = "exposure_absolute";
+	double gain = 0.5;
+	double deadband = 4;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "d|sdd", kwlist, &target, &param, &gain, &deadband)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	if (target <= 0) {
+		self->ae_target = 0;
+		self->cfg.stats = self->stats_on;
+		Py_RETURN_NONE;
+	}
+
+	int i = Camera_find_ctrl(self, param);
+	if (i < 0) {
+		PyErr_Format(PyExc_ValueError, "Unknown control %s", param);
+		return NULL;
+	}
+
+	int value;
+	if (cmv_capture_get_ctrl(&self->cap, self->ctrls[i].id, &value)) {
+		return Camera_ctrl_error(self, &i, 1, 0);
+	}
+	self->ae_id = self->ctrls[i].id;
+	self->ae_min = max(self->ctrls[i].minimum, 1);
+	self->ae_max = self->ctrls[i].maximum;
+	self->ae_value = value;
+	self->ae_target = min(target, 255.0);
+	self->ae_gain = gain;
+	self->ae_deadband = deadband;
+	self->cfg.stats = 1;
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *CameraSetTracking(Camera *self, PyObject *args, PyObject *kwargs) {
+	//enable blob tracking for color, gate=0 disables
+	static char *kwlist [] = {
+		"color",
+		"gate",
+		"confirm",
+		"max_missed",
+		NULL
+	};
+	int color;
+	float gate = 40;
+	int confirm = 3;
+	int max_missed = 5;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "i|fii", kwlist, &color, &gate, &confirm, &max_missed)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	if (color >= 0 && color < COLOR_COUNT) {
+		self->trackers[color].gate = gate;
+		self->trackers[color].confirm = confirm;
+		self->trackers[color].max_missed = max_missed;
+		if (gate <= 0) {
+			self->trackers[color].num = 0;
+		}
+	}
+	
+	Py_RETURN_NONE;
+}
+
+static PyObject *CameraGetTracks(Camera *self, PyObject *args, PyObject *kwargs) {
+	//return confirmed (or all) tracks of color, color=-1 returns tracks of all colors
+	static char *kwlist [] = {
+		"color",
+		"tentative",
+		NULL
+	};
+	int color = -1;
+	int tentative = 0;
+	int c, i, n = 0;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|ii", kwlist, &color, &tentative)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	for (c = 0; c < COLOR_COUNT; c++) {
+		if (color >= 0 && c != color) continue;
+		for (i = 0; i < self->trackers[c].num; i++) {
+			if (tentative || self->trackers[c].tracks[i].confirmed) n++;
+		}
+	}
+
+	Py_INCREF(track_descr);
+	npy_intp dims[1] = {n};
+	PyArrayObject *outArray = (PyArrayObject *) PyArray_SimpleNewFromDescr(1, dims, track_descr);
+	if (outArray == NULL) {
+		return NULL;
+	}
+
+	track_record *out = (track_record *)PyArray_DATA(outArray);
+	for (c = 0; c < COLOR_COUNT; c++) {
+		if (color >= 0 && c != color) continue;
+		for (i = 0; i < self->trackers[c].num; i++) {
+			track *t = &self->trackers[c].tracks[i];
+			if (!tentative && !t->confirmed) continue;
+			out->id = t->id;
+			out->color = c;
+			out->x = t->x;
+			out->y = t->y;
+			out->vx = t->vx;
+			out->vy = t->vy;
+			out->r = t->r;
+			out->phi = t->phi;
+			out->vr = t->vr;
+			out->vphi = t->vphi;
+			out->area = t->area;
+			out->x1 = t->x1;
+			out->x2 = t->x2;
+			out->y1 = t->y1;
+			out->y2 = t->y2;
+			out->age = (unsigned short)min(t->age, 65535);
+			out->missed = (unsigned short)min(t->missed, 65535);
+			out++;
+		}
+	}
+	return PyArray_Return(outArray);
+}
+
+static PyObject *CameraGetBuffer(Camera *self, PyObject *args) {
+	//return segmented buffer (usage np.frombuffer(cam.getBuffer(), dtype=np.uint8).reshape(cam.shape()))
+	ASSERT_IDLE;
+	if (!self->cap.started) Py_RETURN_NONE;
+	
+	/*int size = sizeof(char) * self->vis.width * self->vis.height;
+	
+	return PyBuffer_FromMemory(self->vis.segmented, size);*/
+	
+	npy_intp dims[2] = {self->vis.height, self->vis.width};
+	return Output_view(&self->seg_out, 2, dims, NPY_UINT8);
+}
+
+static PyObject *CameraGetBlobs(Camera *self, PyObject *args) {
+	//get blobs for color, return numpy array [[distance,angle,area,cen_x,cen_y,x1,x2,y1,y2],...]
+	int color;
+	if (!PyArg_ParseTuple(args, "i", &color)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	
+	if (color < 0 || color >= COLOR_COUNT) {
+		PyErr_SetString(PyExc_ValueError, "Invalid color_id");
+		return NULL;
+	}
+	
+	int rows = self->vis.colors[color].num;
+	int cols = 9;
+	unsigned short *pout = (unsigned short *) malloc(max(rows, 1) * cols * sizeof(unsigned short));
+	cmv_fill_blobs(&self->vis, color, pout, rows);
+	
+	npy_intp dims[2] = {rows, cols};
+	PyArrayObject *outArray = (PyArrayObject *) PyArray_SimpleNewFromData(2, dims, NPY_UINT16, pout);
+	PyArray_ENABLEFLAGS(outArray, NPY_ARRAY_OWNDATA);
+	return PyArray_Return(outArray);
+}
+
+static region *Camera_get_blob(Camera *self, PyObject *args) {
+	//region of (color_id, index) in getBlobs() order, NULL with exception set
+	int color, index;
+	region *p;
+
+	if (!PyArg_ParseTuple(args, "ii", &color, &index)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	if (color < 0 || color >= COLOR_COUNT) {
+		PyErr_SetString(PyExc_ValueError, "Invalid color_id");
+		return NULL;
+	}
+	if (index < 0 || index >= self->vis.colors[color].num) {
+		PyErr_SetString(PyExc_IndexError, "Blob index out of range");
+		return NULL;
+	}
+	for (p = cmv_sorted_list(&self->vis, color); index > 0; index--) {
+		p = p->next;
+	}
+	return p;
+}
+
+static PyObject *CameraGetBlobRuns(Camera *self, PyObject *args) {
+	//return runs of one blob [[y, x, width],...]
+	region *p = Camera_get_blob(self, args);
+	int i, n = 0;
+	if (p == NULL) {
+		return NULL;
+	}
+	// runs of a region are chained in image order, next=0 ends the chain
+	for (i = p->run_start; ; i = self->vis.rle[i].next) {
+		n++;
+		if (self->vis.rle[i].next == 0) break;
+	}
+
+	npy_intp dims[2] = {n, 3};
+	PyArrayObject *outArray = (PyArrayObject *) PyArray_SimpleNew(2, dims, NPY_UINT16);
+	if (outArray == NULL) {
+		return NULL;
+	}
+	unsigned short *out = (unsigned short *)PyArray_DATA(outArray);
+	for (i = p->run_start; ; i = self->vis.rle[i].next) {
+		*out++ = self->vis.rle[i].y;
+		*out++ = self->vis.rle[i].x;
+		*out++ = self->vis.rle[i].width;
+		if (self->vis.rle[i].next == 0) break;
+	}
+	return PyArray_Return(outArray);
+}
+
+static PyObject *CameraGetBlobMask(Camera *self, PyObject *args) {
+	//return mask of one blob cropped to its bounding box
+	region *p = Camera_get_blob(self, args);
+	int i;
+	if (p == NULL) {
+		return NULL;
+	}
+
+	int w = p->x2 - p->x1 + 1;
+	npy_intp dims[2] = {p->y2 - p->y1 + 1, w};
+	PyArrayObject *outArray = (PyArrayObject *) PyArray_ZEROS(2, dims, NPY_UINT8, 0);
+	if (outArray == NULL) {
+		return NULL;
+	}
+	unsigned char *mask = (unsigned char *)PyArray_DATA(outArray);
+	for (i = p->run_start; ; i = self->vis.rle[i].next) {
+		run *r = &self->vis.rle[i];
+		memset(&mask[(r->y - p->y1) * w + r->x - p->x1], 1, r->width);
+		if (r->next == 0) break;
+	}
+	return PyArray_Return(outArray);
+}
+
+static PyObject *CameraGetBlobOutline(Camera *self, PyObject *args) {
+	//return leftmost and rightmost pixel of each row of one blob [[y, x_left, x_right],...]
+	region *p = Camera_get_blob(self, args);
+	int i, n = 0;
+	if (p == NULL) {
+		return NULL;
+	}
+
+	npy_intp dims[2] = {p->y2 - p->y1 + 1, 3};
+	PyArrayObject *outArray = (PyArrayObject *) PyArray_SimpleNew(2, dims, NPY_UINT16);
+	if (outArray == NULL) {
+		return NULL;
+	}
+	unsigned short *out = (unsigned short *)PyArray_DATA(outArray);
+	for (i = p->run_start; ; i = self->vis.rle[i].next) {
+		run *r = &self->vis.rle[i];
+		if (n == 0 || out[3 * (n - 1)] != r->y) {
+			// runs of a row are in x order, the first one is leftmost
+			out[3 * n] = r->y;
+			out[3 * n + 1] = r->x;
+			n++;
+		}
+		out[3 * (n - 1) + 2] = r->x + r->width - 1;
+		if (r->next == 0) break;
+	}
+	// rows bridged by vertical closing have no runs
+	PyArray_Dims shape = {dims, 2};
+	dims[0] = n;
+	PyObject *result = PyArray_Resize(outArray, &shape, 0, NPY_CORDER);
+	if (result == NULL) {
+		Py_DECREF(outArray);
+		return NULL;
+	}
+	Py_DECREF(result);
+	return PyArray_Return(outArray);
+}
+
+static PyObject *Camera_masks(Camera *self, const int *colors, int n, int packed, int scale, int nd) {
+	//rasterize runs of colors into masks, nd=2 for a single mask
+	int i;
+	if (scale < 1) {
+		PyErr_SetString(PyExc_ValueError, "scale must be at least 1");
+		return NULL;
+	}
+	for (i = 0; i < n; i++) {
+		if (colors[i] < 0 || colors[i] >= COLOR_COUNT) {
+			PyErr_SetString(PyExc_ValueError, "Invalid color_id");
+			return NULL;
+		}
+	}
+
+	int mw = (self->vis.width + scale - 1) / scale;
+	int mh = (self->vis.height + scale - 1) / scale;
+	npy_intp dims[3] = {n, mh, packed ? (mw + 7) / 8 : mw};
+	unsigned char *out = Output_next(&self->mask_out, (size_t)max(n, 1) * dims[1] * dims[2]);
+	if (out == NULL) {
+		return NULL;
+	}
+	cmv_class_masks(&self->vis, colors, n, scale, packed, out);
+	return Output_view(&self->mask_out, nd, nd == 2 ? dims + 1 : dims, NPY_UINT8);
+}
+
+static PyObject *CameraGetMask(Camera *self, PyObject *args, PyObject *kwargs) {
+	//bit packed (or byte) mask of one color built from the runs
+	static char *kwlist [] = {
+		"color",
+		"packed",
+		"scale",
+		NULL
+	};
+	int color;
+	PyObject *packed = Py_True;
+	int scale = 1;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "i|Oi", kwlist, &color, &packed, &scale)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	return Camera_masks(self, &color, 1, PyObject_IsTrue(packed), scale, 2);
+}
+
+static PyObject *CameraGetMasks(Camera *self, PyObject *args, PyObject *kwargs) {
+	//masks of several colors from a single pass over the runs
+	static char *kwlist [] = {
+		"colors",
+		"packed",
+		"scale",
+		NULL
+	};
+	PyObject *arg1;
+	PyObject *packed = Py_True;
+	int scale = 1;
+	int colors[COLOR_COUNT];
+	int i, n;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Oi", kwlist, &arg1, &packed, &scale)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	PyObject *seq = PySequence_Fast(arg1, "colors must be a sequence");
+	if (seq == NULL) {
+		return NULL;
+	}
+	n = PySequence_Fast_GET_SIZE(seq);
+	if (n > COLOR_COUNT) {
+		Py_DECREF(seq);
+		PyErr_SetString(PyExc_ValueError, "Too many colors");
+		return NULL;
+	}
+	for (i = 0; i < n; i++) {
+		colors[i] = (int)PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+		if (colors[i] == -1 && PyErr_Occurred()) {
+			Py_DECREF(seq);
+			return NULL;
+		}
+	}
+	Py_DECREF(seq);
+	return Camera_masks(self, colors, n, PyObject_IsTrue(packed), scale, 3);
+}
+
+static PyObject *CameraGetRuns(Camera *self) {
+	//return runs of all tracked colors as structured array [(x, y, width, color, region),...]
+	ASSERT_IDLE;
+	int i;
+	int n = 0;
+	run *rle = self->vis.rle;
+	for (i=0; i<self->vis.run_c; i++) {
+		if (self->cfg.classes[rle[i].color].min_area < MAX_INT) n++;
+	}
+
+	Py_INCREF(run_descr);
+	npy_intp dims[1] = {n};
+	PyArrayObject *outArray = (PyArrayObject *) PyArray_SimpleNewFromDescr(1, dims, run_descr);
+	if (outArray == NULL) {
+		return NULL;
+	}
+
+	run_record *out = (run_record *)PyArray_DATA(outArray);
+	for (i=0; i<self->vis.run_c; i++) {
+		if (self->cfg.classes[rle[i].color].min_area < MAX_INT) {
+			out->x = rle[i].x;
+			out->y = rle[i].y;
+			out->width = rle[i].width;
+			out->color = rle[i].color;
+			out->region = rle[i].parent;
+			out++;
+		}
+	}
+	return PyArray_Return(outArray);
+}
+
+static int Camera_set_scanlines(Camera *self, int *pix, int *start, int n) {
+	//take ownership of scanline paths and allocate transition buffer
+	transition_record *out = (transition_record *)malloc(max(start[n], 1) * sizeof(transition_record));
+	if (out == NULL) {
+		free(pix);
+		free(start);
+		PyErr_NoMemory();
+		return -1;
+	}
+	if (self->scan_pix != NULL) {
+		free(self->scan_pix);
+		free(self->scan_start);
+		free(self->scan_out);
+	}
+	self->scan_pix = pix;
+	self->scan_start = start;
+	self->scan_out = out;
+	self->scan_n = n;
+	self->scan_w = self->vis.width;
+	self->scan_h = self->vis.height;
+	return 0;
+}
+
+static PyObject *CameraSetScanlines(Camera *self, PyObject *args) {
+	//set pixel paths [[(x, y),...],...] classified by scan()
+	PyObject *arg1 = NULL;
+	int i, j, n;
+
+	if (!PyArg_ParseTuple(args, "O", &arg1)) return NULL;
+	ASSERT_IDLE;
+	PyObject *seq = PySequence_Fast(arg1, "paths must be a sequence");
+	if (seq == NULL) {
+		return NULL;
+	}
+	n = PySequence_Fast_GET_SIZE(seq);
+	if (n > 65536) {
+		PyErr_SetString(PyExc_ValueError, "Too many paths");
+		Py_DECREF(seq);
+		return NULL;
+	}
+	PyArrayObject **paths = (PyArrayObject **)calloc(max(n, 1), sizeof(PyArrayObject *));
+	int *start = (int *)malloc((n + 1) * sizeof(int));
+	int *pix = NULL;
+	if (paths == NULL || start == NULL) {
+		PyErr_NoMemory();
+		goto fail;
+	}
+
+	start[0] = 0;
+	for (i = 0; i < n; i++) {
+		paths[i] = (PyArrayObject *)PyArray_FROM_OTF(PySequence_Fast_GET_ITEM(seq, i), NPY_INT, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+		if (paths[i] == NULL) {
+			goto fail;
+		}
+		if (PyArray_NDIM(paths[i]) != 2 || PyArray_DIM(paths[i], 1) != 2 || PyArray_DIM(paths[i], 0) > 65536) {
+			PyErr_SetString(PyExc_ValueError, "Path must be an array of at most 65536 (x, y) pairs");
+			goto fail;
+		}
+		start[i + 1] = start[i] + PyArray_DIM(paths[i], 0);
+	}
+	pix = (int *)malloc(max(start[n], 1) * sizeof(int));
+	if (pix == NULL) {
+		PyErr_NoMemory();
+		goto fail;
+	}
+	for (i = 0; i < n; i++) {
+		int *xy = (int *)PyArray_DATA(paths[i]);
+		for (j = 0; j < start[i + 1] - start[i]; j++, xy += 2) {
+			if (xy[0] < 0 || xy[0] >= self->vis.width || xy[1] < 0 || xy[1] >= self->vis.height) {
+				PyErr_SetString(PyExc_ValueError, "Path point outside of image");
+				goto fail;
+			}
+			pix[start[i] + j] = xy[1] * self->vis.width + xy[0];
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		Py_DECREF(paths[i]);
+	}
+	free(paths);
+	Py_DECREF(seq);
+	if (Camera_set_scanlines(self, pix, start, n)) {
+		return NULL;
+	}
+	Py_RETURN_NONE;
+
+fail:
+	if (paths != NULL) {
+		for (i = 0; i < n; i++) {
+			Py_XDECREF(paths[i]);
+		}
+	}
+	free(paths);
+	free(start);
+	free(pix);
+	Py_DECREF(seq);
+	return NULL;
+}
+
+static PyObject *CameraSetRadialScanlines(Camera *self, PyObject *args, PyObject *kwargs) {
+	//set rays from the center as scanline paths
+	static char *kwlist [] = {
+		"rays",
+		"r_min",
+		"r_max",
+		"center",
+		NULL
+	};
+	int rays = 64;
+	int r_min = 0;
+	int r_max = 0;
+	float cx = -1;
+	float cy = -1;
+	int i, k, t;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|iii(ff)", kwlist, &rays, &r_min, &r_max, &cx, &cy)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	if (rays < 1 || rays > 65536 || r_min < 0 || r_max < 0) {
+		PyErr_SetString(PyExc_ValueError, "Invalid rays or radius");
+		return NULL;
+	}
+	if (cx < 0 || cy < 0) {
+		// mirror center is where the location table distance is smallest
+		cx = self->vis.width / 2;
+		cy = self->vis.height / 2;
+		if (self->cfg.loc_r != NULL) {
+			k = 0;
+			for (i = 1; i < self->cfg.loc_w * self->cfg.loc_h; i++) {
+				if (self->cfg.loc_r[i] < self->cfg.loc_r[k]) k = i;
+			}
+			cx = min((k % self->cfg.loc_w) * self->cfg.loc_step, self->vis.width - 1);
+			cy = min((k / self->cfg.loc_w) * self->cfg.loc_step, self->vis.height - 1);
+		}
+	}
+	if (r_max == 0) {
+		r_max = self->vis.width + self->vis.height;
+	}
+
+	int cap = rays * (min(r_max, self->vis.width + self->vis.height) - r_min + 1);
+	int *pix = (int *)malloc(max(cap, 1) * sizeof(int));
+	int *start = (int *)malloc((rays + 1) * sizeof(int));
+	if (pix == NULL || start == NULL) {
+		free(pix);
+		free(start);
+		return PyErr_NoMemory();
+	}
+
+	// step one pixel along the major axis, so no pixel is skipped
+	int n = 0;
+	start[0] = 0;
+	for (k = 0; k < rays; k++) {
+		double a = 2 * M_PI * k / rays;
+		double dx = cos(a);
+		double dy = sin(a);
+		double step = 1 / max(fabs(dx), fabs(dy));
+		int last = -1;
+		for (t = r_min; t <= r_max && n < cap; t++) {
+			int x = (int)lround(cx + dx * step * t);
+			int y = (int)lround(cy + dy * step * t);
+			if (x < 0 || x >= self->vis.width || y < 0 || y >= self->vis.height) {
+				break;
+			}
+			if (y * self->vis.width + x != last) {
+				pix[n++] = last = y * self->vis.width + x;
+			}
+		}
+		start[k + 1] = n;
+	}
+
+	if (Camera_set_scanlines(self, pix, start, rays)) {
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static int Camera_scan_frame(Camera *self, unsigned char *f) {
+// Classifies only the scanline pixels and records every change of
+// color id along each path. Inactive pixels keep the previous color.
+	unsigned char *lookup = self->cfg.colors_lookup;
+	transition_record *out = self->scan_out;
+	int w = self->vis.width;
+	int i, k, xy, y1, u, v;
+	unsigned char c, prev;
+	unsigned short r, phi;
+
+	for (k = 0; k < self->scan_n; k++) {
+		prev = 255;
+		for (i = self->scan_start[k]; i < self->scan_start[k + 1]; i++) {
+			xy = self->scan_pix[i];
+			if (!self->cfg.pixel_active[xy & ~1]) {
+				continue;
+			}
+			y1 = f[2*xy];
+			u = f[4*(xy >> 1) + 1];
+			v = f[4*(xy >> 1) + 3];
+			c = lookup[y1 + (u << 8) + (v << 16)];
+			if (c != prev) {
+				if (prev != 255) {
+					cmv_locate(&self->cfg, xy % w, xy / w, &r, &phi);
+					out->ray = k;
+					out->index = i - self->scan_start[k];
+					out->x = xy % w;
+					out->y = xy / w;
+					out->from = prev;
+					out->to = c;
+					out->r = r;
+					out++;
+				}
+				prev = c;
+			}
+		}
+	}
+	return out - self->scan_out;
+}
+
+static PyObject *CameraScan(Camera *self) {
+	//classify scanlines of next frame and return color transitions
+	ASSERT_IDLE;
+	if (self->scan_pix == NULL) {
+		PyErr_SetString(PyExc_RuntimeError, "No scanlines set");
+		return NULL;
+	}
+	if (self->scan_w != self->vis.width || self->scan_h != self->vis.height) {
+		PyErr_SetString(PyExc_RuntimeError, "Scanlines were set for another resolution");
+		return NULL;
+	}
+	struct v4l2_buffer buffer = Camera_fill_buffer(self);
+	if (buffer.index == -1) {
+		return NULL;
+	}
+
+	int n, err = 0;
+	self->pending = 1;
+	Py_BEGIN_ALLOW_THREADS
+	n = Camera_scan_frame(self, (unsigned char*)self->cap.buffers[buffer.index].start);
+	if (cmv_capture_release(&self->cap, &buffer)) {
+		err = errno;
+	}
+	Py_END_ALLOW_THREADS
+	self->pending = 0;
+	if (err || cmv_record_error(&self->cap)) {
+		errno = err ? err : errno;
+		return PyErr_SetFromErrno(PyExc_IOError);
+	}
+
+	Py_INCREF(transition_descr);
+	npy_intp dims[1] = {n};
+	PyArrayObject *outArray = (PyArrayObject *) PyArray_SimpleNewFromDescr(1, dims, transition_descr);
+	if (outArray == NULL) {
+		return NULL;
+	}
+	memcpy(PyArray_DATA(outArray), self->scan_out, n * sizeof(transition_record));
+	return PyArray_Return(outArray);
+}
+
+static void preview_rect(Camera *self, int x1, int y1, int x2, int y2, const unsigned char *bgr) {
+	// draw clipped rectangle outline into the preview image
+	int pw = self->preview_w;
+	int ph = self->preview_h;
+	int x, y;
+	x1 = max(x1, 0);
+	y1 = max(y1, 0);
+	x2 = min(x2, pw - 1);
+	y2 = min(y2, ph - 1);
+	if (x1 > x2 || y1 > y2) return;
+
+	for (x = x1; x <= x2; x++) {
+		memcpy(&self->preview[3 * (y1 * pw + x)], bgr, 3);
+		memcpy(&self->preview[3 * (y2 * pw + x)], bgr, 3);
+	}
+	for (y = y1; y <= y2; y++) {
+		memcpy(&self->preview[3 * (y * pw + x1)], bgr, 3);
+		memcpy(&self->preview[3 * (y * pw + x2)], bgr, 3);
+	}
+}
+
+static PyObject *CameraRenderPreview(Camera *self, PyObject *args, PyObject *kwargs) {
+	//colorize and downscale segmented image, draw blob bounding boxes and centroids
+	static char *kwlist [] = {
+		"scale",
+		"palette",
+		"draw_blobs",
+		NULL
+	};
+	static const unsigned char white[3] = {255, 255, 255};
+	int scale = 1;
+	PyObject *arg_palette = Py_None;
+	int draw_blobs = 1;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|iOi", kwlist, &scale, &arg_palette, &draw_blobs)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	if (scale < 1) {
+		PyErr_SetString(PyExc_ValueError, "scale must be positive");
+		return NULL;
+	}
+	if (!self->vis.segmented) Py_RETURN_NONE;
+
+	if (arg_palette != Py_None) {
+		//palette is kept for later calls
+		PyArrayObject *palette = (PyArrayObject*)PyArray_FROM_OTF(arg_palette, NPY_UINT8, NPY_ARRAY_IN_ARRAY);
+		if (palette == NULL) {
+			return NULL;
+		}
+		unsigned long size = min(sizeof(self->palette), (unsigned long)PyArray_NBYTES(palette));
+		memcpy(self->palette, PyArray_DATA(palette), size);
+		Py_DECREF(palette);
+	}
+
+	int w = self->vis.width;
+	int h = self->vis.height;
+	int pw = (w + scale - 1) / scale;
+	int ph = (h + scale - 1) / scale;
+	self->preview = Output_next(&self->preview_out, (size_t)pw * ph * 3);
+	if (self->preview == NULL) {
+		return NULL;
+	}
+	self->preview_w = pw;
+	self->preview_h = ph;
+
+	int x, y;
+	unsigned char *out = self->preview;
+	for (y = 0; y < ph; y++) {
+		unsigned char *row = &self->vis.segmented[y * scale * w];
+		for (x = 0; x < pw; x++) {
+			memcpy(out, self->palette[row[x * scale]], 3);
+			out += 3;
+		}
+	}
+
+	if (draw_blobs) {
+		int c;
+		region *p;
+		for (c = 0; c < COLOR_COUNT; c++) {
+			for (p = self->vis.colors[c].list; p != NULL; p = p->next) {
+				int cx = (int)round(p->cen_x) / scale;
+				int cy = (int)round(p->cen_y) / scale;
+				preview_rect(self, p->x1 / scale, p->y1 / scale, p->x2 / scale, p->y2 / scale, white);
+				preview_rect(self, cx - 2, cy, cx + 2, cy, white);
+				preview_rect(self, cx, cy - 2, cx, cy + 2, white);
+			}
+		}
+	}
+
+	npy_intp dims[3] = {ph, pw, 3};
+	return Output_view(&self->preview_out, 3, dims, NPY_UINT8);
+}
+
+typedef struct {
+	unsigned int gen;//odd while the capture thread writes the slot
+	unsigned int seq;
+	unsigned long long time;
+	unsigned int degraded;//CMV_DEGRADED_* flags
+	int counts[COLOR_COUNT];
+	unsigned short *blobs;//[color_n][max_blobs][9]
+} stream_slot;
+
+typedef struct {
+	PyObject_HEAD
+	Camera *cam;
+	pthread_t thread;
+	int thread_started;
+	int stop;//set by consumer to end the capture thread
+	int finished;//capture thread has exited
+	int error;//errno that ended the capture thread
+	int drop;//1=drop oldest result when full, 0=wait until consumer catches up
+	int maxsize;
+	int slot_count;
+	stream_slot *slots;
+	unsigned short *blob_data;
+	stream_slot scratch;//consumer copy of a slot
+	int color_n;
+	int colors[COLOR_COUNT];
+	int max_blobs;
+	unsigned long long head, tail;//published and consumed slot counters
+	sem_t items;//posted for every published slot
+	sem_t spaces;//free slots when not dropping
+	int sems;//number of initialized semaphores
+} Stream;
+
+static int sem_wait_ms(sem_t *sem, int timeout_ms) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += (long)timeout_ms * 1000000;
+	ts.tv_sec += ts.tv_nsec / 1000000000;
+	ts.tv_nsec %= 1000000000;
+	return sem_timedwait(sem, &ts);
+}
+
+static void Stream_publish(Stream *st) {
+// Writes the blobs of the current frame into the next ring slot. The
+// slot generation is odd while it is written, so a consumer reading a
+// slot that gets overwritten (oldest result dropped) notices and retries.
+	Camera *cam = st->cam;
+	unsigned long long head = st->head;
+	int i;
+
+	if (st->drop) {
+		unsigned long long tail = __atomic_load_n(&st->tail, __ATOMIC_ACQUIRE);
+		while (head - tail >= (unsigned long long)st->maxsize) {
+			if (__atomic_compare_exchange_n(&st->tail, &tail, tail + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				break;
+			}
+		}
+	}
+
+	stream_slot *slot = &st->slots[head % st->slot_count];
+	__atomic_store_n(&slot->gen, slot->gen + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->seq = cam->cap.frame_seq;
+	slot->time = cam->cap.frame_time;
+	slot->degraded = cam->vis.degraded;
+	for (i = 0; i < st->color_n; i++) {
+		slot->counts[i] = cmv_fill_blobs(&cam->vis, st->colors[i], &slot->blobs[i * st->max_blobs * 9], st->max_blobs);
+	}
+
+	__atomic_store_n(&slot->gen, slot->gen + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&st->head, head + 1, __ATOMIC_RELEASE);
+	sem_post(&st->items);
+}
+
+static void *Stream_run(void *arg) {
+	//capture thread, never touches python state
+	Stream *st = (Stream *)arg;
+	Camera *cam = st->cam;
+	struct v4l2_buffer buffer;
+	int err = 0;
+
+	while (!__atomic_load_n(&st->stop, __ATOMIC_ACQUIRE)) {
+		if (!st->drop && sem_wait_ms(&st->spaces, 100)) {
+			continue;// consumer is behind, apply backpressure
+		}
+		int ready;
+		do {
+			ready = cmv_capture_wait(&cam->cap, 100);
+		} while ((ready == 0 || (ready < 0 && errno == EINTR)) && !__atomic_load_n(&st->stop, __ATOMIC_ACQUIRE));
+		if (ready <= 0) {
+			err = ready < 0 && errno != EINTR ? errno : 0;
+			break;
+		}
+		if (cmv_capture_dequeue(&cam->cap, &buffer)) {
+			if (errno == EAGAIN) {
+				if (!st->drop) sem_post(&st->spaces);
+				continue;
+			}
+			err = errno;
+			break;
+		}
+
+		Camera_segment(cam, (unsigned char*)cam->cap.buffers[buffer.index].start);
+		//image() is rejected while streaming, so a pool buffer is given back right away
+		if (cmv_capture_release(&cam->cap, &buffer)) {
+			err = errno;
+			break;
+		}
+		if (cam->ae_target > 0 && Camera_auto_exposure(cam)) {
+			err = errno;
+		} else if (cmv_record_error(&cam->cap)) {
+			err = errno;
+		}
+
+		Stream_publish(st);
+		if (err) {
+			break;
+		}
+	}
+
+	st->error = err;
+	__atomic_store_n(&st->finished, 1, __ATOMIC_RELEASE);
+	sem_post(&st->items);
+	return NULL;
+}
+
+static void Stream_stop(Stream *st) {
+	if (st->thread_started) {
+		__atomic_store_n(&st->stop, 1, __ATOMIC_RELEASE);
+		sem_post(&st->spaces);
+		Py_BEGIN_ALLOW_THREADS
+		pthread_join(st->thread, NULL);
+		Py_END_ALLOW_THREADS
+		st->thread_started = 0;
+		st->cam->streaming = 0;
+	}
+}
+
+static void Stream_dealloc(Stream *self) {
+	Stream_stop(self);
+	if (self->sems > 0) {
+		sem_destroy(&self->items);
+	}
+	if (self->sems > 1) {
+		sem_destroy(&self->spaces);
+	}
+	if (self->slots != NULL) {
+		free(self->slots);
+	}
+	if (self->blob_data != NULL) {
+		free(self->blob_data);
+	}
+	Py_XDECREF(self->cam);
+	Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
-static PyObject *CameraSetColorMinArea(Camera *self, PyObject *args) {
-	//set min blob size
-	int color;
-	int min_area;
-
-	if (!PyArg_ParseTuple(args, "ii", &color, &min_area)) {
+static PyObject *Stream_frame(Stream *st) {
+	//build {seq, timestamp, degraded, blobs: {color_id: nparr}} from scratch slot
+	stream_slot *slot = &st->scratch;
+	PyObject *blobs = PyDict_New();
+	int i;
+	if (blobs == NULL) {
 		return NULL;
 	}
-	if (color < COLOR_COUNT) {
-		self->colors[color].min_area = min_area;
+	for (i = 0; i < st->color_n; i++) {
+		npy_intp dims[2] = {slot->counts[i], 9};
+		PyArrayObject *arr = (PyArrayObject *) PyArray_SimpleNew(2, dims, NPY_UINT16);
+		if (arr == NULL) {
+			Py_DECREF(blobs);
+			return NULL;
+		}
+		memcpy(PyArray_DATA(arr), &slot->blobs[i * st->max_blobs * 9], slot->counts[i] * 9 * sizeof(unsigned short));
+		PyObject *key = Py_BuildValue("i", st->colors[i]);
+		if (key == NULL || PyDict_SetItem(blobs, key, (PyObject *)arr)) {
+			Py_XDECREF(key);
+			Py_DECREF(arr);
+			Py_DECREF(blobs);
+			return NULL;
+		}
+		Py_DECREF(key);
+		Py_DECREF(arr);
 	}
-	
-	Py_RETURN_NONE;
-}
-
-static PyObject *CameraSetColors(Camera *self, PyObject *args) {
-	//set colortable
-	PyObject *arg1=NULL;
-	PyArrayObject *lookup=NULL;
-
-	if (!PyArg_ParseTuple(args, "O!", &PyArray_Type, &arg1)) return NULL;
-	lookup = (PyArrayObject*)PyArray_FROM_OTF(arg1, NPY_UINT8, NPY_ARRAY_IN_ARRAY);
-	if (lookup == NULL) {
-		Py_XDECREF(lookup);
+	PyObject *degraded = Camera_degradation_list(slot->degraded);
+	if (degraded == NULL) {
+		Py_DECREF(blobs);
 		return NULL;
 	}
-	
-	unsigned char *data = (unsigned char*)PyArray_DATA(lookup);
-	unsigned long size = min(0x1000000, (unsigned long)PyArray_NBYTES(lookup));
-	memcpy(self->colors_lookup, data, size);
-	
-	Py_DECREF(lookup);
-	Py_RETURN_NONE;
+	return Py_BuildValue("{sIsKsNsN}", "seq", slot->seq, "timestamp", slot->time, "degraded", degraded, "blobs", blobs);
 }
 
-static PyObject *CameraSetActivePixels(Camera *self, PyObject *args) {
-	//set colortable
-	PyObject *arg1=NULL;
-	PyArrayObject *pixels=NULL;
+static PyObject *Stream_next(Stream *st) {
+	stream_slot *scratch = &st->scratch;
+	int i;
+	for (;;) {
+		unsigned long long tail = __atomic_load_n(&st->tail, __ATOMIC_ACQUIRE);
+		unsigned long long head = __atomic_load_n(&st->head, __ATOMIC_ACQUIRE);
+		if (tail == head) {
+			if (__atomic_load_n(&st->finished, __ATOMIC_ACQUIRE)) {
+				if (st->error && st->error != ENODATA) {
+					errno = st->error;
+					Camera_raise();
+				}
+				return NULL;
+			}
+			Py_BEGIN_ALLOW_THREADS
+			sem_wait_ms(&st->items, 100);
+			Py_END_ALLOW_THREADS
+			if (PyErr_CheckSignals()) {
+				return NULL;
+			}
+			continue;
+		}
 
-	if (!PyArg_ParseTuple(args, "O!", &PyArray_Type, &arg1)) return NULL;
-	pixels = (PyArrayObject*)PyArray_FROM_OTF(arg1, NPY_UINT8, NPY_ARRAY_IN_ARRAY);
-	if (pixels == NULL) {
-		Py_XDECREF(pixels);
-		return NULL;
+		stream_slot *slot = &st->slots[tail % st->slot_count];
+		unsigned int gen = __atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE);
+		if (gen & 1) {
+			continue;
+		}
+		scratch->seq = slot->seq;
+		scratch->time = slot->time;
+		scratch->degraded = slot->degraded;
+		for (i = 0; i < st->color_n; i++) {
+			scratch->counts[i] = slot->counts[i];
+			memcpy(&scratch->blobs[i * st->max_blobs * 9], &slot->blobs[i * st->max_blobs * 9], slot->counts[i] * 9 * sizeof(unsigned short));
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->gen, __ATOMIC_RELAXED) != gen) {
+			continue;// overwritten while copying
+		}
+		if (!__atomic_compare_exchange_n(&st->tail, &tail, tail + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			continue;// dropped by capture thread
+		}
+		if (!st->drop) {
+			sem_post(&st->spaces);
+		}
+		return Stream_frame(st);
 	}
-	
-	unsigned char *data = (unsigned char*)PyArray_DATA(pixels);
-	unsigned long size = min(MAX_WIDTH * MAX_HEIGHT, (unsigned long)PyArray_NBYTES(pixels));
-	memcpy(self->pixel_active, data, size);
-	
-	Py_DECREF(pixels);
+}
+
+static PyObject *StreamClose(Stream *self) {
+	Stream_stop(self);
 	Py_RETURN_NONE;
 }
 
-static PyObject *CameraSetLocations(Camera *self, PyObject *args) {
-	//set colortable
-	PyObject *arg1=NULL, *arg2=NULL;
-	PyArrayObject *d_r=NULL, *d_phi=NULL;
+static PyMethodDef Stream_methods[] = {
+	{"close", (PyCFunction)StreamClose, METH_NOARGS,
+		"close()\n\n"
+		"Stop the capture thread."},
+	{NULL}
+};
 
-	if (!PyArg_ParseTuple(args, "O!O!", &PyArray_Type, &arg1, &PyArray_Type, &arg2)) return NULL;
-	d_r = (PyArrayObject*)PyArray_FROM_OTF(arg1, NPY_UINT16, NPY_ARRAY_IN_ARRAY);
-	if (d_r == NULL) {
-		Py_XDECREF(d_r);
+static PyTypeObject Stream_type = {
+#if PY_MAJOR_VERSION < 3
+	PyObject_HEAD_INIT(NULL) 0,
+#else
+	PyVarObject_HEAD_INIT(NULL, 0)
+#endif
+	"pyCMVision.Stream", sizeof(Stream), 0,
+	(destructor)Stream_dealloc, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, Py_TPFLAGS_DEFAULT, "Iterator over frames analysed by a capture thread, "
+	"returned by Camera.stream().", 0, 0, 0,
+	0, PyObject_SelfIter, (iternextfunc)Stream_next, Stream_methods
+};
+
+static PyObject *CameraStream(Camera *self, PyObject *args, PyObject *kwargs) {
+	//start capture thread, return iterator over analysed frames
+	static char *kwlist [] = {
+		"colors",
+		"maxsize",
+		"drop",
+		"blobs",
+		NULL
+	};
+	PyObject *arg_colors = Py_None;
+	int maxsize = 4;
+	int drop = 1;
+	int max_blobs = 64;
+	int i;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|Oiii", kwlist, &arg_colors, &maxsize, &drop, &max_blobs)) {
 		return NULL;
 	}
-	d_phi = (PyArrayObject*)PyArray_FROM_OTF(arg2, NPY_UINT16, NPY_ARRAY_IN_ARRAY);
-	if (d_phi == NULL) {
-		Py_XDECREF(d_phi);
+	ASSERT_OPEN;
+	ASSERT_IDLE;
+	if (maxsize < 1 || max_blobs < 1) {
+		PyErr_SetString(PyExc_ValueError, "maxsize and blobs must be positive");
 		return NULL;
 	}
-	
-	unsigned short *data_r = (unsigned short*)PyArray_DATA(d_r);
-	unsigned long size_r = min(MAX_WIDTH * MAX_HEIGHT * sizeof(unsigned short), (unsigned long)PyArray_NBYTES(d_r));
-	memcpy(self->loc_r, data_r, size_r);
-	
-	unsigned short *data_phi = (unsigned short*)PyArray_DATA(d_phi);
-	unsigned long size_phi = min(MAX_WIDTH * MAX_HEIGHT * sizeof(unsigned short), (unsigned long)PyArray_NBYTES(d_phi));
-	memcpy(self->loc_phi, data_phi, size_phi);
-	
-	Py_DECREF(d_r);
-	Py_DECREF(d_phi);
-	Py_RETURN_NONE;
-}
 
-static void SegEncodeRuns(Camera *self) {
-// Changes the flat array version of the thresholded image into a run
-// length encoded version, which speeds up later processing since we
-// only have to look at the points where values change.
-	unsigned char m, save;
-	unsigned char *row = NULL;
-	int x, y, j, l;
-	run r;
-	unsigned char *map = self->segmented;
-	run *rle = self->rle;
-	
-	int w = self->width;
-	int h = self->height;
-
-	r.next = 0;
-
-	// initialize terminator restore
-	save = map[0];
-
-	j = 0;
-	for(y = 0; y < h; y++){
-		row = &map[y * w];
-
-		// restore previous terminator and store next
-		// one in the first pixel on the next row
-		row[0] = save;
-		save = row[w];
-		row[w] = 255;
-		
-		r.y = y;
-
-		x = 0;
-		while(x < w){
-			m = row[x];
-			r.x = x;
-
-			l = x;
-			while(row[x] == m) x++;
-
-			if(self->colors[m].min_area < MAX_INT || x >= w ) {
-				r.color = m;
-				r.width = x - l;
-				r.parent = j;
-				rle[j++] = r;
-
-				if(j >= MAX_RUNS) {
-					row[w] = save;
-					self->run_c = j;
-					return;
-				}
-			}
-		}
+	Stream *st = (Stream *)Stream_type.tp_alloc(&Stream_type, 0);
+	if (st == NULL) {
+		return NULL;
 	}
+	Py_INCREF(self);
+	st->cam = self;
+	st->drop = drop;
+	st->maxsize = maxsize;
+	st->max_blobs = max_blobs;
 
-	self->run_c = j;
-}
-
-static void SegConnectComponents(Camera *self) {
-// Connect components using four-connecteness so that the runs each
-// identify the global parent of the connected region they are a part
-// of.	It does this by scanning adjacent rows and merging where
-// similar colors overlap.	Used to be union by rank w/ path
-// compression, but now it just uses path compression as the global
-// parent index, a simpler rank bound in practice.
-// WARNING: This code is complicated.	I'm pretty sure it's a correct
-//	 implementation, but minor changes can easily cause big problems.
-//	 Read the papers on this library and have a good understanding of
-//	 tree-based union find before you touch it
-	int l1, l2;
-	run r1, r2;
-	int i, j, s;
-	int num = self->run_c;
-	run *map = self->rle;
-
-	// l2 starts on first scan line, l1 starts on second
-	l2 = 0;
-	l1 = 1;
-	while(map[l1].y == 0) l1++; // skip first line
-
-	// Do rest in lock step
-	r1 = map[l1];
-	r2 = map[l2];
-	s = l1;
-	while(l1 < num){
-		if(r1.color==r2.color && self->colors[r1.color].min_area < MAX_INT){
-			if((r2.x<=r1.x && r1.x<r2.x+r2.width) || (r1.x<=r2.x && r2.x<r1.x+r1.width)){
-				if(s != l1){
-					// if we didn't have a parent already, just take this one
-					map[l1].parent = r1.parent = r2.parent;
-					s = l1;
-				} else if(r1.parent != r2.parent) {
-					// otherwise union two parents if they are different
-
-					// find terminal roots of each path up tree
-					i = r1.parent;
-					while(i != map[i].parent) i = map[i].parent;
-					j = r2.parent;
-					while(j != map[j].parent) j = map[j].parent;
-
-					// union and compress paths; use smaller of two possible
-					// representative indicies to preserve DAG property
-					if(i < j) {
-						map[j].parent = i;
-						map[l1].parent = map[l2].parent = r1.parent = r2.parent = i;
-					} else {
-						map[i].parent = j;
-						map[l1].parent = map[l2].parent = r1.parent = r2.parent = j;
-					}
-				}
-			}
+	if (arg_colors == Py_None) {
+		//all colors with blobs enabled
+		for (i = 0; i < COLOR_COUNT; i++) {
+			if (self->cfg.classes[i].min_area < MAX_INT) st->colors[st->color_n++] = i;
 		}
-
-		// Move to next point where values may change
-		i = (r2.x + r2.width) - (r1.x + r1.width);
-		if(i >= 0) r1 = map[++l1];
-		if(i <= 0) r2 = map[++l2];
-	}
-
-	// Now we need to compress all parent paths
-	for(i=0; i<num; i++){
-		j = map[i].parent;
-		map[i].parent = map[j].parent;
-	}
-}
-
-inline int range_sum(int x, int w) {
-	//foo bar
-	return(w*(2*x + w-1) / 2);
-}
-
-static void SegExtractRegions(Camera *self) {
-// Takes the list of runs and formats them into a region table,
-// gathering the various statistics along the way.	num is the number
-// of runs in the rmap array, and the number of unique regions in
-// reg[] (bounded by max_reg) is returned.	Implemented as a single
-// pass over the array of runs.
-	int b, i, n, a;
-	int num = self->run_c;
-	run *rmap = self->rle;
-	region *reg = self->regions;
-	run r;
-	n = 0;
-
-	for(i=0; i<num; i++){
-		if( self->colors[rmap[i].color].min_area < MAX_INT){
-			r = rmap[i];
-			if(r.parent == i){
-				// Add new region if this run is a root (i.e. self parented)
-				rmap[i].parent = b = n;	// renumber to point to region id
-				reg[b].color = r.color;
-				reg[b].area = r.width;
-				reg[b].x1 = r.x;
-				reg[b].y1 = r.y;
-				reg[b].x2 = r.x + r.width;
-				reg[b].y2 = r.y;
-				reg[b].cen_x = range_sum(r.x,r.width);
-				reg[b].cen_y = r.y * r.width;
-				reg[b].run_start = i;
-				reg[b].iterator_id = i; // temporarily use to store last run
-				n++;
-				if(n >= MAX_REG) {
-					printf( "Regions buffer exceeded.\n" );
-					self->region_c = MAX_REG;
-					return;
-				}
-			} else {
-				// Otherwise update region stats incrementally
-				b = rmap[r.parent].parent;
-				rmap[i].parent = b; // update parent to identify region id
-				reg[b].area += r.width;
-				reg[b].x2 = max(r.x + r.width,reg[b].x2);
-				reg[b].x1 = min((int)r.x,reg[b].x1);
-				reg[b].y2 = r.y; // last set by lowest run
-				reg[b].cen_x += range_sum(r.x,r.width);
-				reg[b].cen_y += r.y * r.width;
-				// set previous run to point to this one as next
-				rmap[reg[b].iterator_id].next = i;
-				reg[b].iterator_id = i;
+	} else {
+		PyObject *seq = PySequence_Fast(arg_colors, "colors must be a sequence");
+		if (seq == NULL) {
+			Py_DECREF(st);
+			return NULL;
+		}
+		for (i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+			long c = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+			if (c < 0 || c >= COLOR_COUNT || st->color_n == COLOR_COUNT) {
+				if (!PyErr_Occurred()) PyErr_SetString(PyExc_ValueError, "Invalid color_id");
+				Py_DECREF(seq);
+				Py_DECREF(st);
+				return NULL;
 			}
+			st->colors[st->color_n++] = c;
 		}
+		Py_DECREF(seq);
 	}
 
-	// calculate centroids from stored sums
-	for(i=0; i<n; i++){
-		a = reg[i].area;
-		reg[i].cen_x = (float)reg[i].cen_x / a;
-		reg[i].cen_y = (float)reg[i].cen_y / a;
-		rmap[reg[i].iterator_id].next = 0; // -1;
-		reg[i].iterator_id = 0;
-		reg[i].x2--; // change to inclusive range
+	// one spare slot, so the producer never writes the slot the consumer is copying
+	// unless it has already dropped it
+	st->slot_count = maxsize + 1;
+	int slot_blobs = max(st->color_n, 1) * max_blobs * 9;
+	st->slots = (stream_slot *)calloc(st->slot_count, sizeof(stream_slot));
+	st->blob_data = (unsigned short *)malloc((st->slot_count + 1) * slot_blobs * sizeof(unsigned short));
+	if (st->slots == NULL || st->blob_data == NULL) {
+		Py_DECREF(st);
+		return PyErr_NoMemory();
 	}
-	self->region_c = n;
-}
-
-static void SegSeparateRegions(Camera *self) {
-// Splits the various regions in the region table a separate list for
-// each color.	The lists are threaded through the table using the
-// region's 'next' field.	Returns the maximal area of the regions,
-// which can be used later to speed up sorting.
-	region *p = NULL;
-	int i;
-	int c;
-	int area;
-	int num = self->region_c;
-	region *reg = self->regions;
-	color_class_state *color = self->colors;
-
-	// clear out the region list head table
-	for(i=0; i<COLOR_COUNT; i++) {
-		color[i].list = NULL;
-		color[i].num	= 0;
+	for (i = 0; i < st->slot_count; i++) {
+		st->slots[i].blobs = &st->blob_data[i * slot_blobs];
+	}
+	st->scratch.blobs = &st->blob_data[st->slot_count * slot_blobs];
+	if (sem_init(&st->items, 0, 0) == 0) {
+		st->sems++;
+	}
+	if (st->sems == 1 && sem_init(&st->spaces, 0, maxsize) == 0) {
+		st->sems++;
+	}
+	if (st->sems < 2) {
+		PyErr_SetFromErrno(PyExc_OSError);
+		Py_DECREF(st);
+		return NULL;
 	}
-	// step over the table, adding successive
-	// regions to the front of each list
-	self->max_area = 0;
-	for(i=0; i<num; i++){
-		p = &reg[i];
-		c = p->color;
-		area = p->area;
 
-		if(area >= color[c].min_area){
-			if(area > self->max_area) self->max_area = area;
-			color[c].num++;
-			p->next = color[c].list;
-			color[c].list = p;
-		}
+	// the thread cannot rotate the segmented ring without the GIL, so it
+	// gets a slot no array uses, getBuffer() is rejected until it ends
+	if (Camera_next_segmented(self)) {
+		Py_DECREF(st);
+		return NULL;
 	}
+	self->streaming = 1;
+	if (pthread_create(&st->thread, NULL, Stream_run, st)) {
+		self->streaming = 0;
+		Py_DECREF(st);
+		return PyErr_SetFromErrno(PyExc_OSError);
+	}
+	st->thread_started = 1;
+
+	return (PyObject *)st;
 }
 
-region* SegSortRegions( region *list, int passes ) {
-// Sorts a list of regions by their area field.
-// Uses a linked list based radix sort to process the list.
-	region *tbl[CMV_RADIX]={NULL}, *p=NULL, *pn=NULL;
-	int slot, shift;
-	int i, j;
+static PyObject *CameraPublish(Camera *self, PyObject *args, PyObject *kwargs) {
+	//publish every analysed frame to shared memory ring
+	static char *kwlist [] = {
+		"name",
+		"slots",
+		"colors",
+		"blobs",
+		"segmented",
+		NULL
+	};
+	const char *name;
+	int slots = 4;
+	PyObject *arg_colors = Py_None;
+	int max_blobs = 64;
+	int segmented = 0;
+	int colors[COLOR_COUNT];
+	int color_n = 0;
+	int i;
 
-	// Handle trivial cases
-	if(!list || !list->next) return(list);
-
-	// Initialize table
-	for(j=0; j<CMV_RADIX; j++) tbl[j] = NULL;
-
-	for(i=0; i<passes; i++){
-		// split list into buckets
-		shift = CMV_RBITS * i;
-		p = list;
-		while(p){
-			pn = p->next;
-			slot = ((p->area) >> shift) & CMV_RMASK;
-			p->next = tbl[slot];
-			tbl[slot] = p;
-			p = pn;
-		}
-
-		// integrate back into partially ordered list
-		list = NULL;
-		for(j=0; j<CMV_RADIX; j++){
-			p = tbl[j];
-			tbl[j] = NULL; // clear out table for next pass
-			while(p){
-				pn = p->next;
-				p->next = list;
-				list = p;
-				p = pn;
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "s|iOii", kwlist, &name, &slots, &arg_colors, &max_blobs, &segmented)) {
+		return NULL;
+	}
+	ASSERT_IDLE;
+	if (slots < 2 || max_blobs < 1) {
+		PyErr_SetString(PyExc_ValueError, "Need at least 2 slots and 1 blob");
+		return NULL;
+	}
+	if (arg_colors == Py_None) {
+		for (i = 0; i < COLOR_COUNT; i++) {
+			if (self->cfg.classes[i].min_area < MAX_INT) colors[color_n++] = i;
+		}
+	} else {
+		PyObject *seq = PySequence_Fast(arg_colors, "colors must be a sequence");
+		if (seq == NULL) {
+			return NULL;
+		}
+		for (i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+			long c = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+			if (c < 0 || c >= COLOR_COUNT || color_n == COLOR_COUNT) {
+				if (!PyErr_Occurred()) PyErr_SetString(PyExc_ValueError, "Invalid color_id");
+				Py_DECREF(seq);
+				return NULL;
 			}
+			colors[color_n++] = c;
 		}
-	}
+		Py_DECREF(seq);
+	}
+
+	Camera_unpublish(self);
+
+	size_t blob_bytes = (size_t)max(color_n, 1) * max_blobs * 9 * sizeof(unsigned short);
+	size_t seg_offset = SHM_ALIGN(sizeof(shm_slot) + blob_bytes);
+	size_t slot_size = SHM_ALIGN(seg_offset + (segmented ? (size_t)self->vis.width * self->vis.height : 0));
+	size_t size = SHM_HEADER_SIZE + slots * slot_size;
+
+	char path[256];
+	snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+	int fd = shm_open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (fd < 0) {
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+	}
+	if (ftruncate(fd, size)) {
+		close(fd);
+		shm_unlink(path);
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+	}
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		shm_unlink(path);
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+	}
+
+	shm_header *hdr = (shm_header *)map;
+	hdr->version = SHM_VERSION;
+	hdr->slot_count = slots;
+	hdr->slot_size = slot_size;
+	hdr->segmented_offset = seg_offset;
+	hdr->color_n = color_n;
+	hdr->max_blobs = max_blobs;
+	hdr->width = self->vis.width;
+	hdr->height = self->vis.height;
+	hdr->has_segmented = segmented;
+	for (i = 0; i < color_n; i++) {
+		hdr->colors[i] = colors[i];
+	}
+	hdr->latest = 0;
+	__atomic_store_n(&hdr->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+	self->shm = map;
+	self->shm_size = size;
+	self->shm_name = strdup(path);
+	Py_RETURN_NONE;
+}
 
-	return(list);
+static PyObject *CameraStopPublishing(Camera *self) {
+	ASSERT_IDLE;
+	Camera_unpublish(self);
+	Py_RETURN_NONE;
 }
 
-static PyObject *CameraAnalyse(Camera *self) {
-	struct v4l2_buffer buffer = Camera_fill_buffer(self);
-	if (buffer.index == -1) {
-		return NULL;
+typedef struct {
+	PyObject_HEAD
+	void *map;
+	size_t size;
+	shm_header hdr;//validated copy, only latest is read from the map again
+} Subscriber;
+
+static int Subscriber_init(Subscriber *self, PyObject *args, PyObject *kwargs) {
+	static char *kwlist [] = {
+		"name",
+		NULL
+	};
+	const char *name;
+	struct stat st;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &name)) {
+		return -1;
 	}
 
-	int w = self->width;
-	int h = self->height;
-	int xy;
-	unsigned char* f = (unsigned char*)self->buffers[buffer.index].start;
-	for (xy = 0; xy < w*h; xy+=2) {
-		int y1, y2, u, v;
-		if (self->pixel_active[xy]) {
-			y1 = f[2*xy];
-			u = f[2*xy+1];
-			y2 = f[2*xy+2];
-			v = f[2*xy+3];
-			self->segmented[xy] = self->colors_lookup[y1 + (u << 8) + (v << 16)];
-			self->segmented[xy+1] = self->colors_lookup[y2 + (u << 8) + (v << 16)];
-		}
+	char path[256];
+	snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+	int fd = shm_open(path, O_RDONLY, 0);
+	if (fd < 0) {
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+		return -1;
+	}
+	if (fstat(fd, &st) || st.st_size < SHM_HEADER_SIZE) {
+		close(fd);
+		PyErr_Format(PyExc_IOError, "%s is not a pyCMVision publisher", path);
+		return -1;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+		return -1;
 	}
 
-	SegEncodeRuns(self);
-	SegConnectComponents(self);
-	SegExtractRegions(self);
-	SegSeparateRegions(self);
+	// the header is only trusted after every offset is checked against the
+	// mapping, and read from a copy afterwards so it cannot change under read()
+	shm_header hdr;
+	int valid = __atomic_load_n(&((shm_header *)map)->magic, __ATOMIC_ACQUIRE) == SHM_MAGIC;
+	memcpy(&hdr, map, sizeof(hdr));
+	size_t blob_bytes = (size_t)hdr.color_n * hdr.max_blobs * 9 * sizeof(unsigned short);
+	valid = valid && hdr.version == SHM_VERSION
+		&& hdr.slot_count > 0 && hdr.slot_size % 8 == 0
+		&& hdr.color_n <= COLOR_COUNT
+		&& sizeof(shm_slot) + blob_bytes <= hdr.slot_size
+		&& SHM_HEADER_SIZE + (size_t)hdr.slot_count * hdr.slot_size <= (size_t)st.st_size;
+	if (valid && hdr.has_segmented) {
+		valid = hdr.width <= MAX_WIDTH && hdr.height <= MAX_HEIGHT
+			&& (size_t)hdr.segmented_offset + (size_t)hdr.width * hdr.height <= hdr.slot_size;
+	}
+	if (!valid) {
+		munmap(map, st.st_size);
+		PyErr_Format(PyExc_IOError, "%s is not a pyCMVision publisher", path);
+		return -1;
+	}
+	if (self->map != NULL) {
+		munmap(self->map, self->size);
+	}
+	self->map = map;
+	self->size = st.st_size;
+	self->hdr = hdr;
+	return 0;
+}
 
-	// do minimal number of passes sufficient to touch all set bits
-	int y = 0;
-	while( self->max_area != 0 ) {
-		self->max_area >>= CMV_RBITS;
-		y++;
+static void Subscriber_dealloc(Subscriber *self) {
+	if (self->map != NULL) {
+		munmap(self->map, self->size);
 	}
-	self->passes = y;
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *SubscriberRead(Subscriber *self, PyObject *args, PyObject *kwargs) {
+	//latest frame {frame, seq, timestamp, blobs, segmented} or None
+	static char *kwlist [] = {
+		"copy",
+		NULL
+	};
+	int copy = 1;
+	unsigned int i;
+	int tries;
 
-	if(my_ioctl(self->fd, VIDIOC_QBUF, &buffer)) {
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &copy)) {
+		return NULL;
+	}
+	if (self->map == NULL) {
+		PyErr_SetString(PyExc_ValueError, "Subscriber is not initialized");
 		return NULL;
 	}
 
-	Py_RETURN_NONE;
-}
+	const shm_header *hdr = &self->hdr;
+	unsigned long long *latest = &((shm_header *)self->map)->latest;
+	for (tries = 0; tries < SHM_READ_TRIES; tries++) {
+		if (tries > 0) {
+			sched_yield();// let the publisher finish the slot
+		}
+		unsigned long long n = __atomic_load_n(latest, __ATOMIC_ACQUIRE);
+		if (n == 0) {
+			Py_RETURN_NONE;
+		}
+		char *base = (char *)self->map + SHM_HEADER_SIZE + ((n - 1) % hdr->slot_count) * hdr->slot_size;
+		shm_slot *slot = (shm_slot *)base;
+		unsigned short *blobs = (unsigned short *)(base + sizeof(shm_slot));
+		unsigned int gen = __atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE);
+		if (gen & 1) {
+			continue;
+		}
 
-static PyObject *CameraGetBuffer(Camera *self, PyObject *args) {
-	//return segmented buffer (usage np.frombuffer(cam.getBuffer(), dtype=np.uint8).reshape(cam.shape()))
-	if (!self->started) Py_RETURN_NONE;
-	
-	/*int size = sizeof(char) * self->width * self->height;
-	
-	return PyBuffer_FromMemory(self->segmented, size);*/
-	
-	npy_intp dims[2] = {self->height, self->width};
-	PyArrayObject *outArray = (PyArrayObject *) PyArray_SimpleNewFromData(2, dims, NPY_UINT8, self->segmented);
-	return PyArray_Return(outArray);
+		PyObject *blob_dict = PyDict_New();
+		PyObject *segmented = Py_None;
+		Py_INCREF(Py_None);
+		if (blob_dict == NULL) {
+			Py_DECREF(segmented);
+			return NULL;
+		}
+		for (i = 0; i < hdr->color_n; i++) {
+			npy_intp dims[2] = {min(slot->counts[i], hdr->max_blobs), 9};
+			PyArrayObject *arr = (PyArrayObject *) PyArray_SimpleNew(2, dims, NPY_UINT16);
+			if (arr == NULL) {
+				Py_DECREF(blob_dict);
+				Py_DECREF(segmented);
+				return NULL;
+			}
+			memcpy(PyArray_DATA(arr), &blobs[i * hdr->max_blobs * 9], dims[0] * 9 * sizeof(unsigned short));
+			PyObject *key = Py_BuildValue("I", hdr->colors[i]);
+			if (key == NULL || PyDict_SetItem(blob_dict, key, (PyObject *)arr)) {
+				Py_XDECREF(key);
+				Py_DECREF(arr);
+				Py_DECREF(blob_dict);
+				Py_DECREF(segmented);
+				return NULL;
+			}
+			Py_DECREF(key);
+			Py_DECREF(arr);
+		}
+		if (hdr->has_segmented) {
+			npy_intp dims[2] = {hdr->height, hdr->width};
+			Py_DECREF(segmented);
+			if (copy) {
+				segmented = PyArray_SimpleNew(2, dims, NPY_UINT8);
+				if (segmented != NULL) {
+					memcpy(PyArray_DATA((PyArrayObject *)segmented), base + hdr->segmented_offset, hdr->width * hdr->height);
+				}
+			} else {
+				//read-only view into the slot, kept alive by the subscriber
+				segmented = PyArray_New(&PyArray_Type, 2, dims, NPY_UINT8, NULL, base + hdr->segmented_offset, 0, NPY_ARRAY_C_CONTIGUOUS, NULL);
+				if (segmented != NULL) {
+					Py_INCREF(self);
+					PyArray_SetBaseObject((PyArrayObject *)segmented, (PyObject *)self);
+				}
+			}
+			if (segmented == NULL) {
+				Py_DECREF(blob_dict);
+				return NULL;
+			}
+		}
+		unsigned int seq = slot->seq;
+		unsigned long long time = slot->time;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->gen, __ATOMIC_RELAXED) != gen) {
+			//overwritten while reading
+			Py_DECREF(blob_dict);
+			Py_DECREF(segmented);
+			continue;
+		}
+		return Py_BuildValue("{sKsIsKsIsNsN}", "frame", n, "seq", seq, "timestamp", time, "gen", gen, "blobs", blob_dict, "segmented", segmented);
+	}
+	// the publisher died or stalls in the middle of writing the latest slot
+	Py_RETURN_NONE;
 }
 
-static PyObject *CameraGetBlobs(Camera *self, PyObject *args) {
-	//get blobs for color, return numpy array [[distance,angle,area,cen_x,cen_y,x1,x2,y1,y2],...]
-	int color;
-	if (!PyArg_ParseTuple(args, "i", &color)) {
+static PyObject *SubscriberValid(Subscriber *self, PyObject *args) {
+	//True if slot of frame returned by read(copy=False) has not been overwritten
+	PyObject *frame;
+	unsigned long long n;
+	unsigned int gen;
+	if (!PyArg_ParseTuple(args, "O!", &PyDict_Type, &frame)) {
 		return NULL;
 	}
-	
-	region *list = SegSortRegions(self->colors[color].list, self->passes);
-	int rows = self->colors[color].num;
-	int cols = 9;
-	int i;
-	int n = 0;
-	int w = self->width;
-	int xy;
-	unsigned short cen_x, cen_y;
-	unsigned short *pout = (unsigned short *) malloc(rows * cols * sizeof(unsigned short));
-
-	for (i=0; i<rows; i++) {
-		cen_x = (unsigned short)round(list[i].cen_x);
-		cen_y = (unsigned short)round(list[i].cen_y);
-		xy = cen_y * w + cen_x;
-		
-		pout[n++] = self->loc_r[xy];
-		pout[n++] = self->loc_phi[xy];
-		pout[n++] = (unsigned short)min(65535 , list[i].area);
-		pout[n++] = cen_x;
-		pout[n++] = cen_y;
-		pout[n++] = (unsigned short)list[i].x1;
-		pout[n++] = (unsigned short)list[i].x2;
-		pout[n++] = (unsigned short)list[i].y1;
-		pout[n++] = (unsigned short)list[i].y2;
+	PyObject *o_n = PyDict_GetItemString(frame, "frame");
+	PyObject *o_gen = PyDict_GetItemString(frame, "gen");
+	if (o_n == NULL || o_gen == NULL) {
+		PyErr_SetString(PyExc_ValueError, "Not a frame returned by read()");
+		return NULL;
 	}
-	
-	npy_intp dims[2] = {rows, cols};
-	PyArrayObject *outArray = (PyArrayObject *) PyArray_SimpleNewFromData(2, dims, NPY_UINT16, pout);
-	PyArray_ENABLEFLAGS(outArray, NPY_ARRAY_OWNDATA);
-	return PyArray_Return(outArray);
+	n = PyLong_AsUnsignedLongLong(o_n);
+	gen = (unsigned int)PyLong_AsUnsignedLong(o_gen);
+	if (PyErr_Occurred() || n == 0) {
+		return NULL;
+	}
+
+	if (self->map == NULL) {
+		PyErr_SetString(PyExc_ValueError, "Subscriber is not initialized");
+		return NULL;
+	}
+	shm_slot *slot = (shm_slot *)((char *)self->map + SHM_HEADER_SIZE + ((n - 1) % self->hdr.slot_count) * self->hdr.slot_size);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return PyBool_FromLong(__atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE) == gen);
 }
 
+static PyMethodDef Subscriber_methods[] = {
+	{"read", (PyCFunction)SubscriberRead, METH_VARARGS | METH_KEYWORDS,
+		"read(bool copy=True) -> {frame, seq, timestamp, gen, blobs, segmented} or None\n\n"
+		"Return latest published frame. copy=False returns segmented image as read-only view."},
+	{"valid", (PyCFunction)SubscriberValid, METH_VARARGS,
+		"valid(frame) -> bool\n\n"
+		"True if views of frame have not been overwritten yet."},
+	{NULL}
+};
+
+static PyTypeObject Subscriber_type = {
+#if PY_MAJOR_VERSION < 3
+	PyObject_HEAD_INIT(NULL) 0,
+#else
+	PyVarObject_HEAD_INIT(NULL, 0)
+#endif
+	"pyCMVision.Subscriber", sizeof(Subscriber), 0,
+	(destructor)Subscriber_dealloc, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, Py_TPFLAGS_DEFAULT, "Subscriber(name)\n\nMaps frames published by "
+	"Camera.publish(name) read-only.", 0, 0, 0,
+	0, 0, 0, Subscriber_methods, 0, 0, 0, 0, 0, 0, 0,
+	(initproc)Subscriber_init
+};
+
 static PyObject *CameraTest(Camera *self) {
 	Py_RETURN_NONE;
 }
 
 static PyMethodDef Camera_methods[] = {
 	{"set", (PyCFunction)Camera_set_ctrl, METH_VARARGS,
-		"set_params(str param, int value)\n\n"
-		"Set V4L2 settings"},
+		"set(str param, int value) -> int seq\n\n"
+		"Set V4L2 setting, returns the sequence number of the first frame using it"},
 	{"get", (PyCFunction)Camera_get_ctrl, METH_VARARGS,
-		"get_params(str param) -> int\n\n"
+		"get(str param) -> int\n\n"
 		"Get V4L2 param value"},
+	{"setMany", (PyCFunction)Camera_set_ctrls, METH_VARARGS,
+		"setMany({str param: int value}) -> int seq\n\n"
+		"Set several V4L2 settings at once, returns the sequence number of the first frame using them"},
+	{"getMany", (PyCFunction)Camera_get_ctrls, METH_VARARGS,
+		"getMany([str param]) -> {str param: int value}\n\n"
+		"Get several V4L2 param values at once"},
+	{"getSequence", (PyCFunction)Camera_get_sequence, METH_NOARGS,
+		"getSequence() -> int\n\n"
+		"Sequence number of the last captured frame"},
 	{"settings", (PyCFunction)Camera_query_ctrls, METH_NOARGS,
 		"settings() -> {str name, int value, int default, int min, int max, int step}\n\n"
 		"Get all V4L2 params"},
@@ -1075,6 +3783,20 @@ static PyMethodDef Camera_methods[] = {
 	{"started", (PyCFunction)CameraStarted, METH_NOARGS,
 		"started() -> bool\n\n"
 		"True if camera is started."},
+	{"record", (PyCFunction)CameraRecord, METH_VARARGS | METH_KEYWORDS,
+		"record(str path, int frames=0, int files=0)\n\n"
+		"Write every captured frame to path. frames > 0 starts a new file path.NNN\n"
+		"after that many frames, files > 0 reuses the oldest file after that many files."},
+	{"usePool", (PyCFunction)CameraUsePool, METH_VARARGS | METH_KEYWORDS,
+		"usePool(pool=None, int size=0) -> bool\n\n"
+		"Capture into writable buffers or dmabuf fds of pool instead of driver buffers,\n"
+		"None returns to driver buffers. False if the driver refused the pool."},
+	{"getFrameIndex", (PyCFunction)CameraGetFrameIndex, METH_NOARGS,
+		"getFrameIndex() -> int\n\n"
+		"Pool buffer holding the last analysed frame, -1 if none."},
+	{"stopRecording", (PyCFunction)CameraStopRecording, METH_NOARGS,
+		"stopRecording()\n\n"
+		"Stop writing captured frames."},
 	{"image", (PyCFunction)Camera_read, METH_VARARGS,
 		"image(str |yuv|rgb|bgr) -> nparr [height, width, 3]\n\n"
 		"Capture image."},
@@ -1084,6 +3806,13 @@ static PyMethodDef Camera_methods[] = {
 	{"setColorMinArea", (PyCFunction)CameraSetColorMinArea, METH_VARARGS,
 		"setColorMinArea(int color_id, int min_area)\n\n"
 		"Find only blobs larger than min_area"},
+	{"setBlobFilter", (PyCFunction)CameraSetBlobFilter, METH_VARARGS | METH_KEYWORDS,
+		"setBlobFilter(int color_id, int max_area=0, float min_aspect=0, float max_aspect=0, float min_fill=0, "
+		"int min_distance=0, int max_distance=0, int min_y=0, int max_y=0)\n\n"
+		"Find only blobs within limits, 0 means no limit"},
+	{"setMorphology", (PyCFunction)CameraSetMorphology, METH_VARARGS | METH_KEYWORDS,
+		"setMorphology(int color_id, int open_w=0, int close_w=0, bool open_h=False, int close_h=0)\n\n"
+		"Drop short runs and bridge small gaps of color before connecting blobs"},
 	{"setColors", (PyCFunction)CameraSetColors, METH_VARARGS,
 		"setColors(nparr)\n\n"
 		"Set color lookup table."},
@@ -1091,17 +3820,117 @@ static PyMethodDef Camera_methods[] = {
 		"setPixels(nparr)\n\n"
 		"Set active pixels table."},
 	{"setLocations", (PyCFunction)CameraSetLocations, METH_VARARGS,
-		"setLocations(nparr distances, nparr angles)\n\n"
-		"Set location lookup table."},
+		"setLocations(nparr distances, nparr angles, int step=1)\n\n"
+		"Set location lookup table, sampled every step pixels."},
+	{"locate", (PyCFunction)CameraLocate, METH_VARARGS,
+		"locate(float x, float y) -> (distance, angle)\n\n"
+		"Map image coordinate to polar coordinate."},
 	{"analyse", (PyCFunction)CameraAnalyse, METH_NOARGS,
 		"analyse()\n\n"
 		"Threshold, find connected components."},
+	{"setIncremental", (PyCFunction)CameraSetIncremental, METH_VARARGS | METH_KEYWORDS,
+		"setIncremental(int tile=32, int threshold=2)\n\n"
+		"Classify only tiles changed since previous frame, tile=0 disables"},
+	{"getDirtyRatio", (PyCFunction)CameraGetDirtyRatio, METH_NOARGS,
+		"getDirtyRatio() -> float\n\n"
+		"Get part of tiles classified again in last frame"},
+	{"setCapacity", (PyCFunction)CameraSetCapacity, METH_VARARGS | METH_KEYWORDS,
+		"setCapacity(int max_runs=327680, int max_regions=81920)\n\n"
+		"Set hard caps of the growing run and region storage"},
+	{"setBudget", (PyCFunction)CameraSetBudget, METH_VARARGS | METH_KEYWORDS,
+		"setBudget(float ms=0, low_priority=())\n\n"
+		"Degrade analyse() to stay within ms per frame, ms=0 disables"},
+	{"getDegradation", (PyCFunction)CameraGetDegradation, METH_NOARGS,
+		"getDegradation() -> [str]\n\n"
+		"Get degradations applied to last frame"},
+	{"getFrameTime", (PyCFunction)CameraGetFrameTime, METH_NOARGS,
+		"getFrameTime() -> float\n\n"
+		"Get segmentation time of last frame in milliseconds"},
+	{"setProfiling", (PyCFunction)CameraSetProfiling, METH_VARARGS | METH_KEYWORDS,
+		"setProfiling(bool enabled=True) -> [str]\n\n"
+		"Time each analyse() stage and count hardware events, returns available counters"},
+	{"getProfile", (PyCFunction)CameraGetProfile, METH_VARARGS | METH_KEYWORDS,
+		"getProfile(bool reset=False) -> dict\n\n"
+		"Get per stage calls, times and counter totals"},
+	{"saveProfile", (PyCFunction)CameraSaveProfile, METH_VARARGS,
+		"saveProfile(str path)\n\n"
+		"Write per stage statistics as CSV"},
+	{"setStatistics", (PyCFunction)CameraSetStatistics, METH_VARARGS | METH_KEYWORDS,
+		"setStatistics(bool enabled=True, bool uv=False)\n\n"
+		"Collect luma histogram and color counts during analyse()."},
+	{"getHistogram", (PyCFunction)CameraGetHistogram, METH_NOARGS,
+		"getHistogram() -> nparr [256] or [3, 256]\n\n"
+		"Return Y (or Y, U, V) histogram of last frame."},
+	{"getColorCounts", (PyCFunction)CameraGetColorCounts, METH_NOARGS,
+		"getColorCounts() -> nparr [color_count]\n\n"
+		"Return pixel count of each color_id in last frame."},
+	{"setAutoExposure", (PyCFunction)CameraSetAutoExposure, METH_VARARGS | METH_KEYWORDS,
+		"setAutoExposure(float target, str control='exposure_absolute', float gain=0.5, float deadband=4)\n\n"
+		"Adjust exposure after every frame towards target mean luma, 0 disables."},
+	{"setTracking", (PyCFunction)CameraSetTracking, METH_VARARGS | METH_KEYWORDS,
+		"setTracking(int color_id, float gate=40, int confirm=3, int max_missed=5)\n\n"
+		"Track blobs with color_id between frames, gate=0 disables."},
+	{"getTracks", (PyCFunction)CameraGetTracks, METH_VARARGS | METH_KEYWORDS,
+		"getTracks(int color_id=-1, bool tentative=False) -> nparr [(id, color, x, y, vx, vy, r, phi, vr, vphi, area, x1, x2, y1, y2, age, missed),...]\n\n"
+		"Return tracks of color_id (-1 for all colors)."},
+	{"stream", (PyCFunction)CameraStream, METH_VARARGS | METH_KEYWORDS,
+		"stream(colors=None, int maxsize=4, bool drop=True, int blobs=64) -> iterator\n\n"
+		"Capture and analyse frames in a native thread, iterate over results."},
+	{"analyseBatch", (PyCFunction)CameraAnalyseBatch, METH_VARARGS | METH_KEYWORDS,
+		"analyseBatch(frames, colors=None, int threads=0) -> nparr BLOB_DTYPE\n\n"
+		"Segment (N, h, w*2) YUYV frames or a recording on all cores, return blobs tagged with frame index"},
+	{"tryAnalyse", (PyCFunction)CameraTryAnalyse, METH_NOARGS,
+		"tryAnalyse() -> bool\n\n"
+		"Analyse a frame if one is ready, return False immediately otherwise."},
+	{"analyse_async", (PyCFunction)CameraAnalyseAsync, METH_NOARGS,
+		"analyse_async() -> asyncio.Future\n\n"
+		"Wait for next frame on the running event loop and analyse it in a native thread."},
+	{"fileno", (PyCFunction)CameraFileno, METH_NOARGS,
+		"fileno() -> int\n\n"
+		"Device file descriptor, readable when a frame is ready."},
+	{"getBlobRuns", (PyCFunction)CameraGetBlobRuns, METH_VARARGS,
+		"getBlobRuns(int color_id, int index) -> nparr [][y, x, width]\n\n"
+		"Get runs of blob index in getBlobs(color_id)"},
+	{"getBlobMask", (PyCFunction)CameraGetBlobMask, METH_VARARGS,
+		"getBlobMask(int color_id, int index) -> nparr [y2-y1+1, x2-x1+1]\n\n"
+		"Get mask of blob index in getBlobs(color_id) within its bounding box"},
+	{"getBlobOutline", (PyCFunction)CameraGetBlobOutline, METH_VARARGS,
+		"getBlobOutline(int color_id, int index) -> nparr [][y, x_left, x_right]\n\n"
+		"Get leftmost and rightmost pixel of each row of blob index in getBlobs(color_id)"},
+	{"setScanlines", (PyCFunction)CameraSetScanlines, METH_VARARGS,
+		"setScanlines(paths)\n\n"
+		"Set pixel paths [[(x, y),...],...] for scan()"},
+	{"setRadialScanlines", (PyCFunction)CameraSetRadialScanlines, METH_VARARGS | METH_KEYWORDS,
+		"setRadialScanlines(int rays=64, int r_min=0, int r_max=0, (float, float) center=None)\n\n"
+		"Set rays from the mirror center as scanline paths for scan()"},
+	{"scan", (PyCFunction)CameraScan, METH_NOARGS,
+		"scan() -> nparr [](ray, index, x, y, from, to, r)\n\n"
+		"Classify only scanline pixels of next frame and return color changes along the paths"},
+	{"publish", (PyCFunction)CameraPublish, METH_VARARGS | METH_KEYWORDS,
+		"publish(str name, int slots=4, colors=None, int blobs=64, bool segmented=False)\n\n"
+		"Write every analysed frame to shared memory ring for Subscriber(name)."},
+	{"stopPublishing", (PyCFunction)CameraStopPublishing, METH_NOARGS,
+		"stopPublishing()\n\n"
+		"Stop publishing and remove shared memory."},
 	{"getBuffer", (PyCFunction)CameraGetBuffer, METH_NOARGS,
 		"getBuffer()\n\n"
 		"Retrieve segmentation buffer."},
 	{"getBlobs", (PyCFunction)CameraGetBlobs, METH_VARARGS,
 		"getBlobs(int color_id)\n\n"
 		"Return connected components with color_id."},
+	{"renderPreview", (PyCFunction)CameraRenderPreview, METH_VARARGS | METH_KEYWORDS,
+		"renderPreview(int scale=1, nparr palette=None, bool draw_blobs=True) -> nparr [height/scale, width/scale, 3]\n\n"
+		"Render colorized bgr preview of segmentation buffer."},
+	{"getMask", (PyCFunction)CameraGetMask, METH_VARARGS | METH_KEYWORDS,
+		"getMask(int color_id, bool packed=True, int scale=1) -> nparr [h/scale, w/scale/8]\n\n"
+		"Mask of a color built from its runs, 8 pixels per byte when packed,\n"
+		"a pixel is set if any pixel of its scale x scale block has the color."},
+	{"getMasks", (PyCFunction)CameraGetMasks, METH_VARARGS | METH_KEYWORDS,
+		"getMasks([int color_id], bool packed=True, int scale=1) -> nparr [n, h/scale, w/scale/8]\n\n"
+		"Masks of several colors built in one pass over the runs."},
+	{"getRuns", (PyCFunction)CameraGetRuns, METH_NOARGS,
+		"getRuns() -> nparr [(x, y, width, color, region),...]\n\n"
+		"Return run length encoded segmentation of tracked colors."},
 	{"test", (PyCFunction)CameraTest, METH_NOARGS,
 		"test()\n\n"
 		"For debugging C code."},
@@ -1123,7 +3952,64 @@ static PyTypeObject Camera_type = {
 	(initproc)Camera_init
 };
 
+static PyObject *decodeRuns(PyObject *module, PyObject *args) {
+	//paint runs (structured array or bytes from getRuns) into a class image
+	PyObject *arg1=NULL;
+	PyArrayObject *runs=NULL;
+	int h, w;
+
+	if (!PyArg_ParseTuple(args, "Oii", &arg1, &h, &w)) return NULL;
+	if (h <= 0 || w <= 0) {
+		PyErr_SetString(PyExc_ValueError, "Invalid image shape");
+		return NULL;
+	}
+	Py_INCREF(run_descr);
+	if (PyBytes_Check(arg1)) {
+		runs = (PyArrayObject*)PyArray_FromBuffer(arg1, run_descr, -1, 0);
+	} else {
+		runs = (PyArrayObject*)PyArray_FromAny(arg1, run_descr, 1, 1, NPY_ARRAY_IN_ARRAY, NULL);
+	}
+	if (runs == NULL) {
+		return NULL;
+	}
+
+	npy_intp dims[2] = {h, w};
+	PyArrayObject *outArray = (PyArrayObject *) PyArray_ZEROS(2, dims, NPY_UINT8, 0);
+	if (outArray == NULL) {
+		Py_DECREF(runs);
+		return NULL;
+	}
+
+	unsigned char *img = (unsigned char *)PyArray_DATA(outArray);
+	run_record *r = (run_record *)PyArray_DATA(runs);
+	npy_intp i, n = PyArray_SIZE(runs);
+	for (i=0; i<n; i++, r++) {
+		if (r->y < h && r->x < w) {
+			memset(&img[r->y * w + r->x], r->color, min((int)r->width, w - r->x));
+		}
+	}
+
+	Py_DECREF(runs);
+	return PyArray_Return(outArray);
+}
+
+static PyArray_Descr *module_add_descr(PyObject *module, const char *name, PyObject *fields) {
+	//build numpy structured dtype and export it as module attribute
+	PyArray_Descr *descr = NULL;
+	if (fields == NULL || !PyArray_DescrConverter(fields, &descr)) {
+		Py_XDECREF(fields);
+		return NULL;
+	}
+	Py_DECREF(fields);
+	Py_INCREF(descr);
+	PyModule_AddObject(module, name, (PyObject *)descr);
+	return descr;
+}
+
 static PyMethodDef module_methods[] = {
+	{"decodeRuns", (PyCFunction)decodeRuns, METH_VARARGS,
+		"decodeRuns(runs, int height, int width) -> nparr [height, width]\n\n"
+		"Paint runs returned by getRuns() (array or bytes) into a segmented image."},
 	{NULL}
 };
 
@@ -1134,8 +4020,13 @@ PyMODINIT_FUNC PyInit_pyCMVision(void)
 #endif
 {
 	Camera_type.tp_new = PyType_GenericNew;
+#if PY_VERSION_HEX < 0x03070000
+	PyEval_InitThreads();
+#endif
 
-	if(PyType_Ready(&Camera_type) < 0) {
+	Subscriber_type.tp_new = PyType_GenericNew;
+
+	if(PyType_Ready(&Camera_type) < 0 || PyType_Ready(&Stream_type) < 0 || PyType_Ready(&Subscriber_type) < 0) {
 #if PY_MAJOR_VERSION < 3
 		return;
 #else
@@ -1173,7 +4064,30 @@ PyMODINIT_FUNC PyInit_pyCMVision(void)
 
 	Py_INCREF(&Camera_type);
 	PyModule_AddObject(module, "Camera", (PyObject *)&Camera_type);
+	Py_INCREF(&Stream_type);
+	PyModule_AddObject(module, "Stream", (PyObject *)&Stream_type);
+	Py_INCREF(&Subscriber_type);
+	PyModule_AddObject(module, "Subscriber", (PyObject *)&Subscriber_type);
 	import_array();
+
+	run_descr = module_add_descr(module, "RUN_DTYPE", Py_BuildValue("[(ss)(ss)(ss)(ss)(ss)]",
+		"x", "<u2", "y", "<u2", "width", "<u2", "color", "u1", "region", "<i4"));
+	track_descr = module_add_descr(module, "TRACK_DTYPE", Py_BuildValue("[(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)]",
+		"id", "<u4", "color", "u1", "x", "<f4", "y", "<f4", "vx", "<f4", "vy", "<f4",
+		"r", "<f4", "phi", "<f4", "vr", "<f4", "vphi", "<f4", "area", "<i4",
+		"x1", "<u2", "x2", "<u2", "y1", "<u2", "y2", "<u2", "age", "<u2", "missed", "<u2"));
+	transition_descr = module_add_descr(module, "TRANSITION_DTYPE", Py_BuildValue("[(ss)(ss)(ss)(ss)(ss)(ss)(ss)]",
+		"ray", "<u2", "index", "<u2", "x", "<u2", "y", "<u2", "from", "u1", "to", "u1", "r", "<u2"));
+	blob_descr = module_add_descr(module, "BLOB_DTYPE", Py_BuildValue("[(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)]",
+		"frame", "<u4", "color", "u1", "distance", "<u2", "angle", "<u2", "area", "<i4", "cen_x", "<f4", "cen_y", "<f4",
+		"x1", "<u2", "x2", "<u2", "y1", "<u2", "y2", "<u2"));
+	if (run_descr == NULL || track_descr == NULL || transition_descr == NULL || blob_descr == NULL) {
+#if PY_MAJOR_VERSION < 3
+		return;
+#else
+		return NULL;
+#endif
+	}
 #if PY_MAJOR_VERSION >= 3
 	return module;
 #endif
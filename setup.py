@@ -23,4 +23,4 @@ setup(
         "License :: Public Domain",
         "Programming Language :: C"],
     ext_modules = [
-        Extension("pyCMVision", ["pyCMVision.c"], libraries = ["v4l2"])])
+        Extension("pyCMVision", ["pyCMVision.c", "cmvision.c", "cmv_capture.c", "cmv_perf.c"], libraries = ["v4l2", "pthread", "rt"])])